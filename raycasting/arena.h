@@ -0,0 +1,75 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for data that lives for one frame (or one tile): allocation is a pointer increment, nothing is
+// freed individually, reset() releases everything at once. The heap blocks are kept across resets, so once the
+// arena has grown to the size of a frame, rendering the next frame does not touch the heap at all.
+class Arena
+{
+public:
+    explicit Arena(const size_t block_size = 1 << 20);
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(const size_t bytes, const size_t align = alignof(std::max_align_t));
+    void reset();
+
+    size_t allocations() const { return allocations_; }    // allocate() calls since the last reset
+    size_t bytes_used() const { return bytes_used_; }       // bytes handed out since the last reset
+    size_t heap_blocks() const { return blocks_acquired_; } // blocks taken from the heap over the arena's lifetime
+    size_t capacity() const;                                // bytes currently held
+
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t block_size_;
+    size_t current_; // block being filled
+    size_t offset_;  // first free byte in it
+    size_t allocations_, bytes_used_, blocks_acquired_;
+};
+
+Arena &frame_arena(); // one per thread, reset by whoever owns the frame / tile on that thread
+
+// STL adapter: containers draw from an arena (the calling thread's frame arena by default), deallocation is a no-op
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+    Arena *arena;
+
+    ArenaAllocator() : arena(&frame_arena()) {}
+    ArenaAllocator(Arena &a) : arena(&a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(const size_t n) { return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Calls to the global operator new since the program started. Counted only by the instrumented build (cmake
+// -DALLOC_STATS=ON defines TINYRAYCASTER_ALLOC_STATS, which replaces operator new); otherwise ALLOC_STATS is false and this is 0, so
+// that the allocations of the rest of the program do not pay for the count.
+#ifdef TINYRAYCASTER_ALLOC_STATS
+const bool ALLOC_STATS = true;
+#else
+const bool ALLOC_STATS = false;
+#endif
+size_t heap_allocations();
+
+#endif // ARENA_H
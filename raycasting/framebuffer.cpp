@@ -29,5 +29,5 @@ void FrameBuffer::draw_rectangle(const size_t rect_x, const size_t rect_y, const
 
 void FrameBuffer::clear(const uint32_t color)
 {
-    img = std::vector<uint32_t>(w * h, color);
+    img.assign(w * h, color); // reuses the storage, clearing is done every frame
 }
@@ -7,6 +7,8 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <cstdlib>
+#include <string>
 
 #include "map.h"
 #include "utils.h"
@@ -14,6 +16,7 @@
 #include "framebuffer.h"
 #include "textures.h"
 #include "sprite.h"
+#include "arena.h"
 
 int wall_x_texcoord(const float hitx, const float hity, Texture &tex_walls)
 {
@@ -36,7 +39,7 @@ void map_sprite(Sprite &sprite, FrameBuffer &fb, Map &map)
     fb.draw_rectangle(sprite.x * map_cell_w - 3, sprite.y * map_cell_h - 3, 6, 6, pack_color(255, 0, 0));
 }
 
-void draw_sprite(Sprite &sprite, std::vector<float> &depth_buffer, FrameBuffer &fb, Player &player, Texture &tex_sprites)
+void draw_sprite(Sprite &sprite, ArenaVector<float> &depth_buffer, FrameBuffer &fb, Player &player, Texture &tex_sprites)
 {
     float sprite_dir = atan2(sprite.y - player.y, sprite.x - player.x); // angle between sprite and player
 
@@ -72,6 +75,7 @@ void draw_sprite(Sprite &sprite, std::vector<float> &depth_buffer, FrameBuffer &
 
 void render(FrameBuffer &fb, Map &map, Player &player, std::vector<Sprite> &sprites, Texture &tex_walls, Texture &tex_monst)
 {
+    frame_arena().reset();               // nothing allocated during the previous frame is alive anymore
     fb.clear(pack_color(255, 255, 255)); // clear the screen with white
 
     const size_t rect_w = fb.w / (map.w * 2); // size of one map cell on the screen
@@ -90,7 +94,7 @@ void render(FrameBuffer &fb, Map &map, Player &player, std::vector<Sprite> &spri
         }
     }
 
-    std::vector<float> depth_buffer(fb.w / 2, 1e3); // buffer to keep track of the Z distance to the walls
+    ArenaVector<float> depth_buffer(fb.w / 2, 1e3); // buffer to keep track of the Z distance to the walls
 
     for (size_t i = 0; i < fb.w / 2; i++)
     { // draw the visibility cone AND the "3D" view
@@ -112,7 +116,7 @@ void render(FrameBuffer &fb, Map &map, Player &player, std::vector<Sprite> &spri
             size_t column_height = fb.h / dist;
 
             int x_texcoord = wall_x_texcoord(x, y, tex_walls);
-            std::vector<uint32_t> column = tex_walls.get_scaled_column(texid, x_texcoord, column_height);
+            ArenaVector<uint32_t> column = tex_walls.get_scaled_column(texid, x_texcoord, column_height);
             int pix_x = i + fb.w / 2; // we are drawing at the right half of the screen, thus +fb.w/2
             for (size_t j = 0; j < column_height; j++)
             { // copy the texture column to the framebuffer
@@ -138,8 +142,20 @@ void render(FrameBuffer &fb, Map &map, Player &player, std::vector<Sprite> &spri
     }
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    size_t frames = 1; // more than one renders the same view repeatedly and reports the allocations of each frame
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--frames" && i + 1 < argc)
+            frames = std::max(1, atoi(argv[++i]));
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--frames N]" << std::endl;
+            return -1;
+        }
+    }
+
     FrameBuffer fb{1024, 512, std::vector<uint32_t>(1024 * 512, pack_color(255, 255, 255))};
     Player player{3.456, 2.345, 1.523, M_PI / 3.};
     Map map;
@@ -162,7 +178,14 @@ int main()
     sprites.push_back({2.764, 7.345, 1, 0}); // they have random positions and directions
     sprites.push_back({2.000, 2.000, 1, 0}); // they have random positions and directions
 
-    render(fb, map, player, sprites, tex_walls, tex_monst);
+    for (size_t frame = 0; frame < frames; frame++)
+    {
+        size_t heap_before = heap_allocations();
+        render(fb, map, player, sprites, tex_walls, tex_monst);
+        if (frames > 1)
+            std::cout << "frame " << frame << ": " << (ALLOC_STATS ? std::to_string(heap_allocations() - heap_before) + " heap allocations, " : "") << frame_arena().allocations()
+                      << " arena allocations (" << frame_arena().bytes_used() << " bytes, " << frame_arena().heap_blocks() << " blocks)" << std::endl;
+    }
     drop_ppm_image("./out.ppm", fb.img, fb.w, fb.h);
 
     return 0;
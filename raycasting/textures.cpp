@@ -57,10 +57,10 @@ uint32_t &Texture::get(const size_t i, const size_t j, const size_t idx)
     return img[i + idx * size + j * img_w];
 }
 
-std::vector<uint32_t> Texture::get_scaled_column(const size_t texture_id, const size_t tex_coord, const size_t column_height)
+ArenaVector<uint32_t> Texture::get_scaled_column(const size_t texture_id, const size_t tex_coord, const size_t column_height)
 {
     assert(tex_coord < size && texture_id < count);
-    std::vector<uint32_t> column(column_height);
+    ArenaVector<uint32_t> column(column_height);
     for (size_t y = 0; y < column_height; y++)
     {
         column[y] = get(tex_coord, (y * size) / column_height, texture_id);
@@ -1,6 +1,8 @@
 #ifndef TEXTURES_H
 #define TEXTURES_H
 
+#include "arena.h"
+
 struct Texture
 {
     size_t img_w, img_h;       // overall image dimensions
@@ -9,7 +11,7 @@ struct Texture
 
     Texture(const std::string filename);
     uint32_t &get(const size_t i, const size_t j, const size_t idx);                                                      // get the pixel (i,j) from the textrue idx
-    std::vector<uint32_t> get_scaled_column(const size_t texture_id, const size_t tex_coord, const size_t column_height); // retrieve one column (tex_coord) from the texture texture_id and scale it to the destination size
+    ArenaVector<uint32_t> get_scaled_column(const size_t texture_id, const size_t tex_coord, const size_t column_height); // retrieve one column (tex_coord) from the texture texture_id and scale it to the destination size (allocated in the frame arena)
 };
 
 #endif // TEXTURES_H
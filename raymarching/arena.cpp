@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "arena.h"
+
+#ifdef TINYKABOOM_ALLOC_STATS
+static std::atomic<size_t> heap_allocation_count(0);
+
+// the global operator new is replaced only to count calls; memory still comes from malloc
+void *operator new(size_t size)
+{
+    heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+size_t heap_allocations()
+{
+    return heap_allocation_count.load(std::memory_order_relaxed);
+}
+#else
+size_t heap_allocations()
+{
+    return 0;
+}
+#endif
+
+Arena &frame_arena()
+{
+    static thread_local Arena arena;
+    return arena;
+}
+
+Arena::Arena(const size_t block_size) : blocks_(), block_size_(block_size), current_(0), offset_(0), allocations_(0), bytes_used_(0), blocks_acquired_(0) {}
+
+Arena::~Arena()
+{
+    for (const Block &b : blocks_)
+        ::operator delete(b.data);
+}
+
+void *Arena::allocate(const size_t bytes, const size_t align)
+{
+    allocations_++;
+    bytes_used_ += bytes;
+    for (;; current_++, offset_ = 0) // the tail of a block is skipped when the request does not fit in it
+    {
+        if (current_ == blocks_.size()) // only while the arena is still growing to the size of a frame
+        {
+            Block b = {nullptr, std::max(block_size_, bytes + align)};
+            b.data = static_cast<char *>(::operator new(b.size));
+            blocks_.push_back(b);
+            blocks_acquired_++;
+        }
+        uintptr_t base = reinterpret_cast<uintptr_t>(blocks_[current_].data);
+        size_t start = ((base + offset_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (start + bytes <= blocks_[current_].size)
+        {
+            offset_ = start + bytes;
+            return blocks_[current_].data + start;
+        }
+    }
+}
+
+void Arena::reset()
+{
+    current_ = 0;
+    offset_ = 0;
+    allocations_ = 0;
+    bytes_used_ = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total = 0;
+    for (const Block &b : blocks_)
+        total += b.size;
+    return total;
+}
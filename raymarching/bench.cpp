@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include "bench.h"
+#include "fast_math.h"
+#include "noise.h"
+#include "march.h"
+#include "sdf.h"
+
+// the noise the raymarcher used before the integer hash, kept verbatim as the baseline
+static float sin_hash(const float n)
+{
+    float x = sin(n) * 43758.5453f;
+    return x - floor(x);
+}
+
+static float sin_lerp(const float v0, const float v1, const float t)
+{
+    return v0 + (v1 - v0) * std::max(0.f, std::min(1.f, t));
+}
+
+static float sin_noise(const Vec3f &x)
+{
+    Vec3f p(floor(x.x), floor(x.y), floor(x.z));
+    Vec3f f(x.x - p.x, x.y - p.y, x.z - p.z);
+    f = f * (f * (Vec3f(3.f, 3.f, 3.f) - f * 2.f));
+    float n = p * Vec3f(1.f, 57.f, 113.f);
+    return sin_lerp(sin_lerp(
+                        sin_lerp(sin_hash(n + 0.f), sin_hash(n + 1.f), f.x),
+                        sin_lerp(sin_hash(n + 57.f), sin_hash(n + 58.f), f.x), f.y),
+                    sin_lerp(
+                        sin_lerp(sin_hash(n + 113.f), sin_hash(n + 114.f), f.x),
+                        sin_lerp(sin_hash(n + 170.f), sin_hash(n + 171.f), f.x), f.y),
+                    f.z);
+}
+
+__attribute__((noinline)) static float sin_fractal_brownian_motion(const Vec3f &x)
+{
+    Vec3f p(Vec3f(0.00, 0.80, 0.60) * x, Vec3f(-0.80, 0.36, -0.48) * x, Vec3f(-0.60, -0.48, 0.64) * x);
+    float f = 0;
+    f += 0.5000 * sin_noise(p);
+    p = p * 2.32;
+    f += 0.2500 * sin_noise(p);
+    p = p * 3.03;
+    f += 0.1250 * sin_noise(p);
+    p = p * 2.61;
+    f += 0.0625 * sin_noise(p);
+    return f / 0.9375;
+}
+
+// points where the raymarcher evaluates the noise: signed_distance scales the position by 3.4 and the fireball
+// grows to a radius of 2.5, the padding to a multiple of NOISE_LANES is the caller's business
+static void random_points(const size_t n, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> coord(-3.4f * 3.f, 3.4f * 3.f);
+    x.resize(n), y.resize(n), z.resize(n);
+    for (size_t i = 0; i < n; i++)
+        x[i] = coord(gen), y[i] = coord(gen), z[i] = coord(gen);
+}
+
+bool check_noise(std::ostream &out, const float tolerance)
+{
+    const size_t n = 1 << 20;
+    std::vector<float> x, y, z;
+    random_points(n, x, y, z);
+    for (int k = 0; k < NOISE_LANES; k++) // lattice corners and cell borders, where floor and the hash can go wrong
+    {
+        x[k] = -2.f + k, y[k] = 0.f, z[k] = (k & 1) ? -0.f : 1e-7f;
+        x[NOISE_LANES + k] = std::nextafter((float)k, -1e9f), y[NOISE_LANES + k] = -(float)k, z[NOISE_LANES + k] = 0.5f;
+    }
+
+    float max_noise = 0, max_fbm = 0;
+    size_t mismatches = 0;
+    float lanes[NOISE_LANES];
+    for (size_t i = 0; i < n; i += NOISE_LANES)
+    {
+        noise8(&x[i], &y[i], &z[i], lanes);
+        for (int k = 0; k < NOISE_LANES; k++)
+        {
+            float d = std::abs(lanes[k] - noise(Vec3f(x[i + k], y[i + k], z[i + k])));
+            max_noise = std::max(max_noise, d);
+            mismatches += d != 0;
+        }
+        fractal_brownian_motion8(&x[i], &y[i], &z[i], lanes);
+        for (int k = 0; k < NOISE_LANES; k++)
+        {
+            float d = std::abs(lanes[k] - fractal_brownian_motion(Vec3f(x[i + k], y[i + k], z[i + k])));
+            max_fbm = std::max(max_fbm, d);
+            mismatches += d != 0;
+        }
+    }
+    bool ok = max_noise <= tolerance && max_fbm <= tolerance;
+    out << "noise kernel " << noise_kernel_name() << ": " << n << " points, max |noise8 - noise| = " << max_noise
+        << ", max |fbm8 - fbm| = " << max_fbm << ", " << mismatches << " inexact lanes, tolerance " << tolerance
+        << (ok ? ": ok" : ": FAILED") << std::endl;
+    return ok;
+}
+
+// one pass over all points, in millions of evaluations per second; the results feed a checksum so nothing is optimized away
+template <typename Eval>
+static double measure(const size_t n, Eval eval, double &checksum)
+{
+    typedef std::chrono::steady_clock clock;
+    checksum = 0;
+    clock::time_point start = clock::now();
+    for (size_t i = 0; i < n; i += NOISE_LANES)
+        checksum += eval(i);
+    return n / std::chrono::duration<double>(clock::now() - start).count() * 1e-6;
+}
+
+void bench_noise(std::ostream &out)
+{
+    const size_t n = 1 << 20;
+    const int runs = 7; // the variants take turns and each keeps its best run, so clock drift hits all of them alike
+    std::vector<float> x, y, z;
+    random_points(n, x, y, z);
+
+    double legacy = 0, scalar = 0, simd = 0;
+    double sum_legacy, sum_scalar, sum_simd;
+    for (int run = 0; run < runs; run++)
+    {
+        legacy = std::max(legacy, measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += sin_fractal_brownian_motion(Vec3f(x[i + k], y[i + k], z[i + k]));
+            return s;
+        }, sum_legacy));
+        scalar = std::max(scalar, measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += fractal_brownian_motion(Vec3f(x[i + k], y[i + k], z[i + k]));
+            return s;
+        }, sum_scalar));
+        simd = std::max(simd, measure(n, [&](size_t i) {
+            float lanes[NOISE_LANES], s = 0;
+            fractal_brownian_motion8(&x[i], &y[i], &z[i], lanes);
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += lanes[k];
+            return s;
+        }, sum_simd));
+    }
+    out << "kernel\tsin_hash\tscalar\t" << noise_kernel_name() << "\t(M fBm evaluations/s, one thread)" << std::endl;
+    out << std::fixed << std::setprecision(2) << "fbm\t" << legacy << "\t" << scalar << "\t" << simd << std::endl;
+    out.unsetf(std::ios::fixed);
+    if (sum_scalar != sum_simd)
+        out << "warning: the scalar and SIMD kernels disagree" << std::endl;
+    if (!std::isfinite(sum_legacy))
+        out << "warning: the sin-hash noise produced garbage" << std::endl;
+}
+
+// the benchmark scenes written out by hand, the way signed_distance is
+static float hand_fireball(const Vec3f &p, const float radius)
+{
+    return p.norm() - radius + fractal_brownian_motion(p * 3.4f) * noise_amplitude;
+}
+
+static float hand_mixed(const Vec3f &p)
+{
+    const float c = std::cos(.5f), s = std::sin(.5f), k = .3f;
+    float ball = (p - Vec3f(0, .3f, 0)).norm() - .8f;
+    Vec3f r(c * p.x - s * p.z, p.y, s * p.x + c * p.z);
+    float ring = std::sqrt(r.x * r.x + r.z * r.z) - 1.2f;
+    float torus = std::sqrt(ring * ring + r.y * r.y) - .25f;
+    float h = std::max(k - std::abs(ball - torus), 0.f) / k;
+    float blob = std::min(ball, torus) - h * h * k * .25f;
+
+    Vec3f q(std::abs(p.x - 1.5f) - .5f, std::abs(p.y) - .5f, std::abs(p.z) - .5f);
+    float box = Vec3f(std::max(q.x, 0.f), std::max(q.y, 0.f), std::max(q.z, 0.f)).norm() + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+    float rounded = std::max(box, (p - Vec3f(1.5f, 0, 0)).norm() - .65f);
+    float floor = p.y + 1;
+    return std::min(std::min(blob, rounded), floor);
+}
+
+void bench_sdf(std::ostream &out)
+{
+    const size_t n = 1 << 20;
+    const int runs = 7;
+    std::vector<float> x, y, z;
+    random_points(n, x, y, z);
+    for (size_t i = 0; i < n; i++) // the scenes fit in [-3, 3]^3
+        x[i] /= 3.4f, y[i] /= 3.4f, z[i] /= 3.4f;
+
+    const float radius = 1.75;
+    auto fireball = displace(sdf_sphere(radius), noise_amplitude, 3.4f);
+    auto mixed = smooth_union(translate(sdf_sphere(.8f), Vec3f(0, .3f, 0)), rotate_y(sdf_torus(1.2f, .25f), .5f), .3f) |
+                 (translate(sdf_box(Vec3f(.5f, .5f, .5f)) & sdf_sphere(.65f), Vec3f(1.5f, 0, 0))) |
+                 sdf_floor(-1);
+
+    const char *names[2] = {"fireball", "mixed"};
+    double hand[2] = {0, 0}, composed[2] = {0, 0};
+    double sum_hand[2], sum_composed[2];
+    for (int run = 0; run < runs; run++)
+    {
+        hand[0] = std::max(hand[0], measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += hand_fireball(Vec3f(x[i + k], y[i + k], z[i + k]), radius);
+            return s;
+        }, sum_hand[0]));
+        composed[0] = std::max(composed[0], measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += fireball(Vec3f(x[i + k], y[i + k], z[i + k]));
+            return s;
+        }, sum_composed[0]));
+        hand[1] = std::max(hand[1], measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += hand_mixed(Vec3f(x[i + k], y[i + k], z[i + k]));
+            return s;
+        }, sum_hand[1]));
+        composed[1] = std::max(composed[1], measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += mixed(Vec3f(x[i + k], y[i + k], z[i + k]));
+            return s;
+        }, sum_composed[1]));
+    }
+    out << "scene\thand-written\tcomposed\tratio\t(M distance evaluations/s, one thread)" << std::endl;
+    for (int m = 0; m < 2; m++)
+    {
+        out << names[m] << "\t" << std::fixed << std::setprecision(2) << hand[m] << "\t" << composed[m] << "\t"
+            << std::setprecision(3) << composed[m] / hand[m] << std::endl;
+        out.unsetf(std::ios::fixed);
+        if (sum_hand[m] != sum_composed[m])
+            out << "warning: the composed " << names[m] << " scene does not match the hand-written one" << std::endl;
+    }
+}
+
+// one function of fast_math.h against libm: throughput of both and the largest error of the fast one against libm in
+// double precision, relative except where the bound is 0 (floor has to be exact). lo > 0: the domain is sampled
+// log-uniformly. Inlined, as in the renderer.
+template <typename Libm, typename Fast, typename Exact>
+static void bench_fast_math_case(std::ostream &out, const char *name, const float lo, const float hi, const double bound,
+                                 Libm libm_eval, Fast fast_eval, Exact exact_eval)
+{
+    const size_t n = 1 << 20;
+    const int runs = 7;
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> t(0.f, 1.f);
+    std::vector<float> x(n);
+    for (size_t i = 0; i < n; i++)
+        x[i] = lo > 0 ? lo * std::pow(hi / lo, t(gen)) : lo + (hi - lo) * t(gen);
+    for (size_t i = 0; i < 64; i++) // integers and their neighbours, where floor can go wrong
+        x[i] = std::max(lo, std::min(hi, lo > 0 ? (float)(i + 1) : std::nextafter(std::round(x[i]), i % 3 == 0 ? -1e9f : i % 3 == 1 ? 1e9f : std::round(x[i]))));
+    x[64] = lo, x[65] = hi;
+    double libm = 0, fast = 0, sum_libm, sum_fast;
+    for (int run = 0; run < runs; run++)
+    {
+        libm = std::max(libm, measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += libm_eval(x[i + k]);
+            return s;
+        }, sum_libm));
+        fast = std::max(fast, measure(n, [&](size_t i) {
+            float s = 0;
+            for (int k = 0; k < NOISE_LANES; k++)
+                s += fast_eval(x[i + k]);
+            return s;
+        }, sum_fast));
+    }
+    double error = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        double exact = exact_eval((double)x[i]), d = std::abs(fast_eval(x[i]) - exact);
+        error = std::max(error, bound == 0 ? d : d / std::abs(exact));
+    }
+    if (!(std::abs(sum_fast - sum_libm) <= 1e-3 * std::abs(sum_libm))) // also keeps both loops from being optimized away
+        out << "warning: the fast " << name << " and libm disagree on the sum of the results" << std::endl;
+    out << name << "\t" << std::fixed << std::setprecision(2) << libm << "\t" << fast << "\t" << fast / libm << "\t";
+    out.unsetf(std::ios::fixed);
+    out << error << "\t" << bound << (error <= bound ? "" : "\tEXCEEDED") << std::endl;
+}
+
+void bench_fast_math(std::ostream &out)
+{
+    out << "function\tlibm\tfast\tspeedup\tmax error\tbound\t(M evaluations/s, one thread; " << (FAST_MATH ? "fast" : "libm")
+        << " in the renderer)" << std::endl;
+    bench_fast_math_case(out, "floor", -1000.f, 1000.f, 0, [](float x) { return std::floor(x); }, [](float x) { return fast_floor(x); }, [](double x) { return std::floor(x); });
+    bench_fast_math_case(out, "sqrt", 1e-6f, 1e6f, 6e-8, [](float x) { return std::sqrt(x); }, [](float x) { return fast_sqrt(x); }, [](double x) { return std::sqrt(x); });
+    bench_fast_math_case(out, "tan", -.78539816f, .78539816f, 3e-7, [](float x) { return std::tan(x); }, [](float x) { return fast_tan(x); }, [](double x) { return std::tan(x); });
+    bench_fast_math_case(out, "exp", -87.f, 88.f, 3e-7, [](float x) { return std::exp(x); }, [](float x) { return fast_exp(x); }, [](double x) { return std::exp(x); });
+}
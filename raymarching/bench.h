@@ -0,0 +1,21 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+#include <iostream>
+
+// fractal_brownian_motion8 against the scalar reference on random points; prints the largest difference and returns
+// whether it stays within tolerance
+bool check_noise(std::ostream &out, const float tolerance = 1e-6f);
+
+// single-thread fBm throughput in millions of evaluations per second: the original sin-hash noise, the scalar
+// integer-hash reference and the 8-wide kernel
+void bench_noise(std::ostream &out);
+
+// the fireball and a mixed primitive scene composed from sdf.h against the same functions written out by hand, in
+// millions of distance evaluations per second (one thread); warns if the two disagree
+void bench_sdf(std::ostream &out);
+
+// floor, sqrt, tan and exp of fast_math.h against libm: single-thread throughput of both and the largest error of
+// the fast version on random points of its domain, flagged where it exceeds the documented bound
+void bench_fast_math(std::ostream &out);
+
+#endif //__BENCH_H__
@@ -0,0 +1,73 @@
+#ifndef __FAST_MATH_H__
+#define __FAST_MATH_H__
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+#include "geometry.h"
+
+// Replacements for the libm calls of the hot loops, without branches into libm and free of errno, so that they
+// inline and vectorize. The bounds are for the stated domains, checked on dense samples by bench_fast_math.
+//   fast_floor: exact for |x| < 2^31
+//   fast_sqrt:  correctly rounded, relative error below 6e-8 (the SSE instruction)
+//   fast_tan:   relative error below 3e-7 for |x| <= pi/4 (a [7/6] Pade approximant), libm beyond
+//   fast_exp:   relative error below 3e-7 for -87 <= x <= 88 (2^n times a polynomial for e^r, |r| <= ln 2 / 2);
+//               x is clamped to that range, NaN included
+// hot_norm is what the renderer calls for the distance to the centre: fast_sqrt when compiled with
+// TINYKABOOM_FAST_MATH (cmake -DFAST_MATH=ON), libm otherwise, so that the default build renders exactly what it did
+// before. It is the only replacement that pays off in a whole frame (4 to 6% on frames 60-65, the same image): floor
+// already compiles to the rounding instruction, expf beats fast_exp, and the one tan per frame is not worth its
+// error. The others stay for bench_fast_math.
+
+inline float fast_floor(const float x)
+{
+#if defined(__SSE4_1__)
+    return _mm_cvtss_f32(_mm_floor_ss(_mm_setzero_ps(), _mm_set_ss(x))); // roundss, what libm's floor inlines to
+#else
+    int32_t i = (int32_t)x; // truncates toward zero, one too high for negative non-integers
+    return (float)(i - (x < (float)i)); // in integers, so that it stays free of branches: in the noise they are coin tosses
+#endif
+}
+
+inline float fast_sqrt(const float x)
+{
+#if defined(__SSE__)
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x))); // sqrtss without libm's errno check for negative x
+#else
+    return std::sqrt(x);
+#endif
+}
+
+inline float fast_tan(const float x)
+{
+    if (!(std::abs(x) <= .78539816f))
+        return std::tan(x);
+    float x2 = x * x;
+    return x * (135135.f - x2 * (17325.f - x2 * (378.f - x2))) / (135135.f - x2 * (62370.f - x2 * (3150.f - x2 * 28.f)));
+}
+
+inline float fast_exp(const float x)
+{
+    // x = n ln 2 + r with |r| <= ln 2 / 2, ln 2 split in two so that n ln 2 comes out exact (Cody-Waite)
+    float y = std::max(-87.f, std::min(x, 88.f)), n = fast_floor(y * 1.44269504f + .5f);
+    float r = (y - n * .693145752f) - n * 1.42860677e-6f;
+    float p = 1.f + r * (1.f + r * (.5f + r * (1.f / 6 + r * (1.f / 24 + r * (1.f / 120 + r * (1.f / 720))))));
+    uint32_t bits;
+    std::memcpy(&bits, &p, sizeof(bits));
+    bits += (uint32_t)(int32_t)n << 23; // into the exponent
+    std::memcpy(&p, &bits, sizeof(p));
+    return p;
+}
+
+#ifdef TINYKABOOM_FAST_MATH
+const bool FAST_MATH = true;
+inline float hot_norm(const Vec3f &v) { return fast_sqrt(v.x * v.x + v.y * v.y + v.z * v.z); }
+#else
+const bool FAST_MATH = false;
+inline float hot_norm(const Vec3f &v) { return v.norm(); }
+#endif
+
+#endif //__FAST_MATH_H__
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "framebuffer.h"
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "rows of Vec3f are converted as flat float arrays");
+
+bool parse_pixel_format(const std::string &name, PixelFormat &format)
+{
+    if (name == "rgb32f")
+        format = PIXEL_RGB32F;
+    else if (name == "rgba16f")
+        format = PIXEL_RGBA16F;
+    else if (name == "rgb8")
+        format = PIXEL_RGB8;
+    else
+        return false;
+    return true;
+}
+
+size_t pixel_size(PixelFormat format)
+{
+    switch (format)
+    {
+    case PIXEL_RGBA16F:
+        return 4 * sizeof(uint16_t);
+    case PIXEL_RGB8:
+        return 3;
+    default:
+        return 3 * sizeof(float);
+    }
+}
+
+FrameBuffer::FrameBuffer(const size_t w, const size_t h, const PixelFormat format) : w(w), h(h), format(format), img(w * h * pixel_size(format)) {}
+
+void FrameBuffer::store_row(const size_t j, const Vec3f *colors)
+{
+    store_span(0, j, colors, w);
+}
+
+void FrameBuffer::store_span(const size_t i, const size_t j, const Vec3f *colors, const size_t n)
+{
+    uint8_t *dst = row(j) + i * pixel_size(format);
+    switch (format)
+    {
+    case PIXEL_RGBA16F:
+        convert_rgb32f_to_rgba16f(&colors[0].x, reinterpret_cast<uint16_t *>(dst), n);
+        break;
+    case PIXEL_RGB8:
+        convert_rgb32f_to_rgb8(&colors[0].x, dst, n);
+        break;
+    default:
+        memcpy(dst, colors, n * sizeof(Vec3f));
+    }
+}
+
+void FrameBuffer::load_row(const size_t j, Vec3f *colors) const
+{
+    switch (format)
+    {
+    case PIXEL_RGBA16F:
+        convert_rgba16f_to_rgb32f(reinterpret_cast<const uint16_t *>(row(j)), &colors[0].x, w);
+        break;
+    case PIXEL_RGB8:
+        convert_rgb8_to_rgb32f(row(j), &colors[0].x, w);
+        break;
+    default:
+        memcpy(colors, row(j), w * sizeof(Vec3f));
+    }
+}
+
+void FrameBuffer::drop_ppm_image(const std::string &filename) const
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs << "P6\n"
+        << w << " " << h << "\n255\n";
+    std::vector<uint8_t> rgb(format == PIXEL_RGB8 ? 0 : w * 3); // quantized row, unused when the storage is RGB8 already
+    for (size_t j = 0; j < h; j++)
+    {
+        const uint8_t *src = row(j);
+        if (format == PIXEL_RGBA16F)
+            convert_rgba16f_to_rgb8(reinterpret_cast<const uint16_t *>(src), rgb.data(), w);
+        else if (format == PIXEL_RGB32F)
+            convert_rgb32f_to_rgb8(reinterpret_cast<const float *>(src), rgb.data(), w);
+        ofs.write(reinterpret_cast<const char *>(format == PIXEL_RGB8 ? src : rgb.data()), w * 3);
+    }
+    ofs.close();
+}
+
+bool read_ppm_image(const std::string &filename, FrameBuffer &fb)
+{
+    std::ifstream ifs(filename, std::ios::binary);
+    std::string magic;
+    size_t w, h, maxval;
+    if (!(ifs >> magic >> w >> h >> maxval) || magic != "P6" || maxval != 255 || ifs.get() == EOF) // one whitespace before the pixels
+        return false;
+    fb = FrameBuffer(w, h, PIXEL_RGB8);
+    return static_cast<bool>(ifs.read(reinterpret_cast<char *>(fb.img.data()), fb.img.size()));
+}
+
+// float <-> half with round to nearest even, after https://gist.github.com/rygorous/2156668
+uint16_t float_to_half(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+
+    uint16_t h;
+    if (u >= (127u + 16) << 23) // out of range: Inf, or NaN (kept quiet)
+        h = u > 255u << 23 ? 0x7e00 : 0x7c00;
+    else if (u < 113u << 23) // subnormal or zero, let the FPU do the rounding
+    {
+        const uint32_t magic_u = 126u << 23; // 0.5f
+        float magic, x;
+        memcpy(&magic, &magic_u, sizeof(magic));
+        memcpy(&x, &u, sizeof(x));
+        x += magic;
+        memcpy(&u, &x, sizeof(u));
+        h = (uint16_t)(u - magic_u);
+    }
+    else
+    {
+        uint32_t mant_odd = (u >> 13) & 1;
+        u += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+        h = (uint16_t)(u >> 13);
+    }
+    return h | (uint16_t)(sign >> 16);
+}
+
+float half_to_float(uint16_t h)
+{
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t u = (h & 0x7fffu) << 13;
+    uint32_t exp = shifted_exp & u;
+    u += (uint32_t)(127 - 15) << 23;
+    float f;
+    if (exp == shifted_exp) // Inf / NaN
+        u += (uint32_t)(128 - 16) << 23;
+    else if (exp == 0) // zero / subnormal, renormalize
+    {
+        const uint32_t magic_u = 113u << 23;
+        float magic;
+        memcpy(&magic, &magic_u, sizeof(magic));
+        u += 1u << 23;
+        memcpy(&f, &u, sizeof(f));
+        f -= magic;
+        memcpy(&u, &f, sizeof(u));
+    }
+    u |= (uint32_t)(h & 0x8000u) << 16;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint8_t quantize(float c) // same rounding as the original PPM writers: clamp, scale, truncate
+{
+    return (uint8_t)(255 * std::max(0.f, std::min(1.f, c)));
+}
+
+void convert_rgb32f_to_rgba16f(const float *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__) && defined(__SSE4_1__)
+    const __m128 one = _mm_set1_ps(1.f);
+    for (; i + 3 <= n; i += 2) // each 4-wide load reads the next pixel's red, the last pixels go through the scalar tail
+    {
+        __m128 a = _mm_blend_ps(_mm_loadu_ps(src + 3 * i), one, 8);
+        __m128 b = _mm_blend_ps(_mm_loadu_ps(src + 3 * i + 3), one, 8);
+        __m256 ab = _mm256_insertf128_ps(_mm256_castps128_ps256(a), b, 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm256_cvtps_ph(ab, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        for (size_t c = 0; c < 3; c++)
+            dst[4 * i + c] = float_to_half(src[3 * i + c]);
+        dst[4 * i + 3] = 0x3c00; // 1.0
+    }
+}
+
+void convert_rgba16f_to_rgb32f(const uint16_t *src, float *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 1 < n; i++) // the 4-wide store spills into the next pixel, which overwrites it right after
+        _mm_storeu_ps(dst + 3 * i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + 4 * i))));
+#endif
+    for (; i < n; i++)
+    {
+        for (size_t c = 0; c < 3; c++)
+            dst[3 * i + c] = half_to_float(src[4 * i + c]);
+    }
+}
+
+void convert_rgb32f_to_rgb8(const float *src, uint8_t *dst, size_t n)
+{
+    size_t i = 0, count = n * 3; // channels are independent, treat the row as a flat stream
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), scale = _mm_set1_ps(255.f);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i q[4];
+        for (size_t k = 0; k < 4; k++)
+        {
+            __m128 v = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i + 4 * k), one), zero);
+            q[k] = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), bytes);
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = quantize(src[i]);
+}
+
+void convert_rgba16f_to_rgb8(const uint16_t *src, uint8_t *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__) && defined(__SSSE3__)
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), scale = _mm_set1_ps(255.f);
+    const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; i + 6 <= n; i += 4) // 4 pixels per step, the 16 byte store carries 12 bytes of payload and must stay inside dst
+    {
+        __m256 p01 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i)));
+        __m256 p23 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i + 8)));
+        __m128 p[4] = {_mm256_castps256_ps128(p01), _mm256_extractf128_ps(p01, 1), _mm256_castps256_ps128(p23), _mm256_extractf128_ps(p23, 1)};
+        __m128i q[4];
+        for (size_t k = 0; k < 4; k++)
+            q[k] = _mm_cvttps_epi32(_mm_mul_ps(_mm_max_ps(_mm_min_ps(p[k], one), zero), scale));
+        __m128i rgba = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 3 * i), _mm_shuffle_epi8(rgba, drop_alpha));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        for (size_t c = 0; c < 3; c++)
+            dst[3 * i + c] = quantize(half_to_float(src[4 * i + c]));
+    }
+}
+
+void convert_rgb8_to_rgb32f(const uint8_t *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n * 3; i++) // simple enough for the auto-vectorizer
+        dst[i] = src[i] * (1.f / 255.f);
+}
+
+namespace
+{
+struct YuvCoefficients // 8 bit fixed point
+{
+    int16_t y[3], u[3], v[3];
+    int16_t y_offset;
+};
+const YuvCoefficients video_range = {{66, 129, 25}, {-38, -74, 112}, {112, -94, -18}, 16};
+const YuvCoefficients full_range_coefficients = {{77, 150, 29}, {-43, -85, 128}, {128, -107, -21}, 0};
+
+// chroma rounds with 127, not 128: 128 * 255 + 128 would not fit the 16 bit lanes of the SIMD path
+inline uint8_t luma(const YuvCoefficients &c, const int r, const int g, const int b)
+{
+    return (uint8_t)(((c.y[0] * r + c.y[1] * g + c.y[2] * b + 128) >> 8) + c.y_offset);
+}
+inline uint8_t chroma(const int16_t *k, const int r, const int g, const int b)
+{
+    return (uint8_t)(((k[0] * r + k[1] * g + k[2] * b + 127) >> 8) + 128);
+}
+} // namespace
+
+void convert_rgb8_to_yuv420(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                            size_t n, bool full_range)
+{
+    const YuvCoefficients &c = full_range ? full_range_coefficients : video_range;
+    size_t i = 0;
+#if defined(__SSE4_1__)
+    // 16 pixels per step: deinterleave the 48 bytes of a row into R, G and B, widen to 16 bits, multiply-add
+    const __m128i r_from[3] = {_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)};
+    const __m128i g_from[3] = {_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)};
+    const __m128i b_from[3] = {_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),
+                               _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)};
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ky[3] = {_mm_set1_epi16(c.y[0]), _mm_set1_epi16(c.y[1]), _mm_set1_epi16(c.y[2])};
+    const __m128i ku[3] = {_mm_set1_epi16(c.u[0]), _mm_set1_epi16(c.u[1]), _mm_set1_epi16(c.u[2])};
+    const __m128i kv[3] = {_mm_set1_epi16(c.v[0]), _mm_set1_epi16(c.v[1]), _mm_set1_epi16(c.v[2])};
+    const __m128i y_round = _mm_set1_epi16(128), c_round = _mm_set1_epi16(127), two = _mm_set1_epi16(2);
+    const __m128i y_offset = _mm_set1_epi16(c.y_offset), c_offset = _mm_set1_epi16(128);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i sum[3][2]; // R, G and B of the 2x2 blocks, low and high 8 pixels, summed over both rows
+        const uint8_t *rows[2] = {rgb0 + 3 * i, rgb1 + 3 * i};
+        uint8_t *ys[2] = {y0 + i, y1 + i};
+        for (int k = 0; k < 2; k++)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k]));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + 16));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + 32));
+            const __m128i *from[3] = {r_from, g_from, b_from};
+            __m128i channel[3][2];
+            for (int ch = 0; ch < 3; ch++)
+            {
+                __m128i bytes = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, from[ch][0]), _mm_shuffle_epi8(b, from[ch][1])),
+                                             _mm_shuffle_epi8(d, from[ch][2]));
+                channel[ch][0] = _mm_cvtepu8_epi16(bytes);
+                channel[ch][1] = _mm_unpackhi_epi8(bytes, zero);
+                for (int h = 0; h < 2; h++)
+                    sum[ch][h] = k ? _mm_add_epi16(sum[ch][h], channel[ch][h]) : channel[ch][h];
+            }
+            __m128i lum[2];
+            for (int h = 0; h < 2; h++) // at most 256 * 255 + 128, fits unsigned 16 bits
+            {
+                __m128i acc = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(channel[0][h], ky[0]), _mm_mullo_epi16(channel[1][h], ky[1])),
+                                            _mm_add_epi16(_mm_mullo_epi16(channel[2][h], ky[2]), y_round));
+                lum[h] = _mm_add_epi16(_mm_srli_epi16(acc, 8), y_offset);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(ys[k]), _mm_packus_epi16(lum[0], lum[1]));
+        }
+        __m128i avg[3];
+        for (int ch = 0; ch < 3; ch++) // horizontal pairs, then the rounded mean of the four
+            avg[ch] = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(sum[ch][0], sum[ch][1]), two), 2);
+        __m128i cu = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(avg[0], ku[0]), _mm_mullo_epi16(avg[1], ku[1])),
+                                   _mm_add_epi16(_mm_mullo_epi16(avg[2], ku[2]), c_round));
+        __m128i cv = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(avg[0], kv[0]), _mm_mullo_epi16(avg[1], kv[1])),
+                                   _mm_add_epi16(_mm_mullo_epi16(avg[2], kv[2]), c_round));
+        cu = _mm_add_epi16(_mm_srai_epi16(cu, 8), c_offset);
+        cv = _mm_add_epi16(_mm_srai_epi16(cv, 8), c_offset);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(u + i / 2), _mm_packus_epi16(cu, cu));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(v + i / 2), _mm_packus_epi16(cv, cv));
+    }
+#endif
+    for (; i < n; i += 2)
+    {
+        const size_t i1 = std::min(i + 1, n - 1);
+        const uint8_t *p[4] = {rgb0 + 3 * i, rgb0 + 3 * i1, rgb1 + 3 * i, rgb1 + 3 * i1};
+        y0[i] = luma(c, p[0][0], p[0][1], p[0][2]);
+        y1[i] = luma(c, p[2][0], p[2][1], p[2][2]);
+        if (i1 != i)
+        {
+            y0[i1] = luma(c, p[1][0], p[1][1], p[1][2]);
+            y1[i1] = luma(c, p[3][0], p[3][1], p[3][2]);
+        }
+        int avg[3];
+        for (int ch = 0; ch < 3; ch++)
+            avg[ch] = (p[0][ch] + p[1][ch] + p[2][ch] + p[3][ch] + 2) >> 2;
+        u[i / 2] = chroma(c.u, avg[0], avg[1], avg[2]);
+        v[i / 2] = chroma(c.v, avg[0], avg[1], avg[2]);
+    }
+}
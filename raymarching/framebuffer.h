@@ -0,0 +1,50 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+enum PixelFormat
+{
+    PIXEL_RGB32F,  // 12 bytes per pixel, three floats, what the renderers compute
+    PIXEL_RGBA16F, // 8 bytes per pixel, half floats (alpha = 1), keeps the HDR range for accumulation
+    PIXEL_RGB8     // 3 bytes per pixel, already quantized the way the PPM / encoder output expects it
+};
+
+bool parse_pixel_format(const std::string &name, PixelFormat &format); // "rgb32f", "rgba16f" or "rgb8"
+size_t pixel_size(PixelFormat format);                                 // bytes per pixel
+
+struct FrameBuffer
+{
+    size_t w, h;              // image dimensions
+    PixelFormat format;       // storage layout of img
+    std::vector<uint8_t> img; // storage container, w * h * pixel_size(format) bytes
+
+    FrameBuffer(const size_t w, const size_t h, const PixelFormat format);
+    uint8_t *row(const size_t j) { return img.data() + j * w * pixel_size(format); }
+    const uint8_t *row(const size_t j) const { return img.data() + j * w * pixel_size(format); }
+    void store_row(const size_t j, const Vec3f *colors); // converts one row of colors into the storage format
+    void store_span(const size_t i, const size_t j, const Vec3f *colors, const size_t n); // pixels i .. i + n - 1 of row j
+    void load_row(const size_t j, Vec3f *colors) const;  // and back (lossy for the compact formats)
+    void drop_ppm_image(const std::string &filename) const;
+};
+
+bool read_ppm_image(const std::string &filename, FrameBuffer &fb); // a binary PPM with maxval 255, as RGB8
+
+// conversion kernels, n is the number of pixels; SSE / F16C when the compiler targets them, scalar otherwise
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+void convert_rgb32f_to_rgba16f(const float *src, uint16_t *dst, size_t n);
+void convert_rgba16f_to_rgb32f(const uint16_t *src, float *dst, size_t n);
+void convert_rgb32f_to_rgb8(const float *src, uint8_t *dst, size_t n);
+void convert_rgba16f_to_rgb8(const uint16_t *src, uint8_t *dst, size_t n);
+void convert_rgb8_to_rgb32f(const uint8_t *src, float *dst, size_t n);
+// BT.601 YCbCr 4:2:0 from two rows of RGB8: both rows of luma and one row of chroma, each chroma sample from the
+// average of a 2x2 block (the last column pairs with itself when n is odd). full_range: 0..255 for all three as JPEG
+// wants them, otherwise the video range (16..235, 16..240) players assume for Y4M. The same integers with or without SSE4.1.
+void convert_rgb8_to_yuv420(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                            size_t n, bool full_range);
+
+#endif //__FRAMEBUFFER_H__
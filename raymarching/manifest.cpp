@@ -0,0 +1,89 @@
+#include <fstream>
+#include <sstream>
+#include "manifest.h"
+
+uint64_t file_checksum(const std::string &path, size_t &bytes, bool &ok)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    bytes = 0;
+    std::ifstream in(path, std::ios::binary);
+    ok = static_cast<bool>(in);
+    char buffer[1 << 16];
+    while (in)
+    {
+        in.read(buffer, sizeof(buffer));
+        for (std::streamsize k = 0; k < in.gcount(); k++)
+            hash = (hash ^ (uint8_t)buffer[k]) * 0x100000001b3ull;
+        bytes += in.gcount();
+    }
+    ok = ok && in.eof();
+    return hash;
+}
+
+FrameManifest::FrameManifest(const std::string &path, const int frames)
+    : path_(path), entries_(frames, Entry{std::string(), 0, 0, false}), render_seconds_(frames, 0), file_(nullptr)
+{
+}
+
+FrameManifest::~FrameManifest()
+{
+    if (file_)
+        std::fclose(file_);
+}
+
+bool FrameManifest::load()
+{
+    std::ifstream in(path_);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        int frame;
+        Entry e;
+        double render, write;
+        if (!(fields >> frame >> e.file >> e.bytes >> std::hex >> e.checksum >> std::dec >> render >> write) || frame < 0 ||
+            frame >= (int)entries_.size())
+            return false;
+        e.present = true;
+        entries_[frame] = e; // the latest line of a frame wins
+    }
+    return true;
+}
+
+bool FrameManifest::open()
+{
+    bool fresh = !std::ifstream(path_);
+    file_ = std::fopen(path_.c_str(), "a");
+    if (file_ && fresh)
+        std::fputs("# frame file bytes fnv1a64 render_seconds write_seconds\n", file_);
+    return file_ && std::fflush(file_) == 0;
+}
+
+bool FrameManifest::done(const int frame) const
+{
+    const Entry &e = entries_[frame];
+    if (!e.present)
+        return false;
+    size_t bytes;
+    bool ok;
+    uint64_t checksum = file_checksum(e.file, bytes, ok);
+    return ok && bytes == e.bytes && checksum == e.checksum;
+}
+
+void FrameManifest::set_render_seconds(const int frame, const double seconds)
+{
+    render_seconds_[frame] = seconds;
+}
+
+bool FrameManifest::record(const int frame, const std::string &file, const double write_seconds)
+{
+    size_t bytes;
+    bool ok;
+    uint64_t checksum = file_checksum(file, bytes, ok); // what actually reached the disk
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[frame] = Entry{file, bytes, checksum, ok};
+    return ok && std::fprintf(file_, "%d %s %zu %016llx %.6f %.6f\n", frame, file.c_str(), bytes, (unsigned long long)checksum,
+                              render_seconds_[frame], write_seconds) > 0 && std::fflush(file_) == 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+uint64_t file_checksum(const std::string &path, size_t &bytes, bool &ok); // FNV-1a over the whole file
+
+// What a render has written so far, one line per finished frame, appended and flushed as each file is closed so
+// that a killed render leaves a manifest of exactly the frames it completed:
+//   frame file bytes fnv1a64 render_seconds write_seconds
+// A frame counts as done when its file still has the size and checksum of its latest line.
+class FrameManifest
+{
+public:
+    FrameManifest(const std::string &path, const int frames);
+    ~FrameManifest();
+    bool load();                  // the lines of an earlier run, if the file exists; false on a malformed line
+    bool open();                  // for appending, false on failure
+    bool done(const int frame) const; // checks the file on disk against its line
+    void set_render_seconds(const int frame, const double seconds); // before the frame goes to record()
+    bool record(const int frame, const std::string &file, const double write_seconds); // false on I/O errors
+
+private:
+    struct Entry
+    {
+        std::string file;
+        size_t bytes;
+        uint64_t checksum;
+        bool present;
+    };
+    std::string path_;
+    std::vector<Entry> entries_;
+    std::vector<double> render_seconds_;
+    std::FILE *file_;
+    std::mutex mutex_;
+};
+
+#endif //__MANIFEST_H__
@@ -0,0 +1,471 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include "fast_math.h"
+#include "noise.h"
+#include "march.h"
+
+// The footprint of a sample at p for fractal_brownian_motion's LOD: the pixel cone's width at p's distance from the
+// eye, in the units of the noise (p * 3.4), times ctx.noise_lod. False if every octave counts in full.
+static bool noise_footprint(const RenderContext &ctx, const Vec3f &p, float &footprint)
+{
+    if (ctx.pixel_angle <= 0 && ctx.octaves >= FBM_OCTAVES)
+        return false;
+    footprint = (p - ctx.eye).norm() * ctx.pixel_angle * 3.4f * ctx.noise_lod;
+    return true;
+}
+
+// ctx.sdf_cache holds the field of the full analytic noise at one radius; any other field goes without it
+static bool cache_applies(const RenderContext &ctx)
+{
+    return ctx.sdf_cache && ctx.sdf_cache->radius() == ctx.sphere_radius && !ctx.noise_grid && ctx.pixel_angle <= 0 &&
+           ctx.octaves >= FBM_OCTAVES;
+}
+
+// signed_distance without the cache, for the normals and the cone march: the normals are taken at the surface, in
+// the cache's exact shell or their eps beyond it, and neither must see the cache's shortened distances
+static float field_distance(const RenderContext &ctx, const Vec3f &p)
+{
+    Vec3f x = object_point(ctx, p) * 3.4;
+    float fbm, footprint;
+    if (ctx.noise_grid)
+        fbm = ctx.noise_grid->sample(x);
+    else if (noise_footprint(ctx, p, footprint))
+    {
+        fbm = fractal_brownian_motion(x, footprint, ctx.octaves);
+        if (ctx.octave_counter)
+            ctx.octave_counter->add(fbm_octaves(footprint, ctx.octaves));
+    }
+    else
+    {
+        fbm = fractal_brownian_motion(x);
+        if (ctx.octave_counter)
+            ctx.octave_counter->add(FBM_OCTAVES);
+    }
+    float displacement = -fbm * noise_amplitude;
+    return hot_norm(p) - (ctx.sphere_radius + displacement);
+}
+
+float signed_distance(const RenderContext &ctx, const Vec3f &p)
+{
+    float cached;
+    if (cache_applies(ctx) && ctx.sdf_cache->distance(object_point(ctx, p), cached))
+        return cached;
+    return field_distance(ctx, p);
+}
+
+// signed_distance along a march: once the cache has left a sample to the field (near the surface), exact stays set
+// and the rest of the march goes without the cache, which would only send it back again and again
+static float march_distance(const RenderContext &ctx, const Vec3f &p, bool &exact)
+{
+    float cached;
+    if (!exact && ctx.sdf_cache->distance(object_point(ctx, p), cached))
+        return cached;
+    exact = true;
+    return field_distance(ctx, p);
+}
+
+bool sphere_trace_fixed(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, MarchEnd *end)
+{
+    if (MARCH_STATS && end)
+        *end = MARCH_EXIT;
+    if (orig * orig - pow(orig * dir, 2) > pow(ctx.sphere_radius, 2))
+        return false;
+    pos = orig;
+    for (steps = 0; steps < ctx.march.max_steps;)
+    {
+        float d = signed_distance(ctx, pos);
+        steps++;
+        if (d < 0)
+        {
+            if (MARCH_STATS && end)
+                *end = MARCH_HIT;
+            return true;
+        }
+        pos = pos + dir * std::max(d * 0.1f, .01f);
+    }
+    if (MARCH_STATS && end) // the fixed steps never stop at the far side of the sphere
+        *end = MARCH_STEP_LIMIT;
+    return false;
+}
+
+// Sphere tracing with steps of d / L (L = ctx.march.lipschitz, a bound on the gradient of signed_distance), over-relaxed
+// by ctx.march.relaxation. An over-relaxed step is taken back when the unbounding spheres of its two ends do not touch
+// (there may be a surface in the gap); a step that lands inside is refined by bisection. Marches [t, t_exit] with a
+// budget of ctx.march.max_steps; a start point that is already inside is reported as such, not as a hit. t_clear is the
+// last sample before the first one that came closer than ctx.march.seed_distance to the surface; out_of_steps tells a
+// miss that used up the budget from one that left the sphere (with MARCH_STATS only).
+static bool march_segment(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, float t, const float t_exit, Vec3f &pos, int &steps, bool &started_inside, float &t_clear,
+                          bool &out_of_steps)
+{
+    float omega = ctx.march.relaxation, step = 0, prev_radius = 0, t_prev = t;
+    started_inside = false;
+    t_clear = t;
+    bool clear = true;
+    int budget = ctx.march.max_steps;
+    bool exact = !cache_applies(ctx);
+    for (; budget > 0 && t <= t_exit; budget--)
+    {
+        float d = march_distance(ctx, orig + dir * t, exact);
+        steps++;
+        float radius = std::abs(d) / ctx.march.lipschitz;
+        float plain = std::max(prev_radius, ctx.march.min_step);
+        if (omega > 1 && step > plain && radius + prev_radius < step) // the relaxed step overshot the safe region, redo it plainly
+        {
+            t -= step;
+            step = plain;
+            omega = 1;
+            t += step;
+            continue;
+        }
+        if (d < 0 && t == t_prev)
+        {
+            started_inside = true;
+            return false;
+        }
+        if (d < 0) // the surface lies between t_prev (outside) and t (inside)
+        {
+            float lo = t_prev, hi = t;
+            for (int k = 0; k < ctx.march.refine_steps; k++, steps++)
+            {
+                float mid = (lo + hi) * .5f;
+                (march_distance(ctx, orig + dir * mid, exact) < 0 ? hi : lo) = mid;
+            }
+            pos = orig + dir * hi; // stay inside, as the fixed stepper does
+            return true;
+        }
+        clear = clear && d >= ctx.march.seed_distance;
+        if (clear)
+            t_clear = t;
+        step = std::max(radius * omega, ctx.march.min_step);
+        prev_radius = radius;
+        t_prev = t;
+        t += step;
+    }
+    if (MARCH_STATS)
+        out_of_steps = budget == 0;
+    return false;
+}
+
+// Marching is limited to the segment inside the bounding sphere: the displacement only ever pushes the surface
+// inwards. A seed t_min past the entry point (where the previous frame was still clear of the surface) is only
+// trusted if the march from there starts outside and finds a surface; otherwise the ray is marched again from the
+// entry point.
+bool sphere_trace_lipschitz(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, const float t_min, float *t_clear,
+                            MarchEnd *end)
+{
+    float clear;
+    if (!t_clear)
+        t_clear = &clear;
+    steps = 0;
+    if (MARCH_STATS && end)
+        *end = MARCH_HIT;
+    float b = orig * dir, c = orig * orig - ctx.sphere_radius * ctx.sphere_radius;
+    float disc = b * b - c;
+    if (disc < 0)
+    {
+        if (MARCH_STATS && end)
+            *end = MARCH_EXIT;
+        return false;
+    }
+    float t_enter = std::max(0.f, -b - std::sqrt(disc)), t_exit = -b + std::sqrt(disc);
+    bool started_inside, out_of_steps = false;
+    if (t_min > t_enter && t_min < t_exit && march_segment(ctx, orig, dir, t_min, t_exit, pos, steps, started_inside, *t_clear, out_of_steps))
+        return true;
+    if (march_segment(ctx, orig, dir, t_enter, t_exit, pos, steps, started_inside, *t_clear, out_of_steps))
+        return true;
+    if (started_inside) // the eye is inside the fireball
+        pos = orig + dir * t_enter;
+    else if (MARCH_STATS && end)
+        *end = out_of_steps ? MARCH_STEP_LIMIT : MARCH_EXIT;
+    return started_inside;
+}
+
+// Each step must keep the whole cross-section of the cone inside the unbounding sphere, no over-relaxation: a ray
+// point t' of the cone projects to at most t' on the axis, so once the axis is covered up to t every ray is clear up
+// to t as well. The march starts where no ray can have reached the bounding sphere yet and ends with a miss once the
+// cone is past the far side of the sphere.
+bool cone_march(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, const float half_angle, float &t_start, int &steps)
+{
+    const float spread = std::tan(half_angle), distance = orig.norm();
+    float t = std::max(0.f, (distance - ctx.sphere_radius) * std::cos(half_angle));
+    for (steps = 0; steps < ctx.march.max_steps; steps++)
+    {
+        if (t > distance + ctx.sphere_radius)
+            return false;
+        float free = field_distance(ctx, orig + dir * t) / ctx.march.lipschitz - t * spread; // the cache's values would stop it early
+        if (free < ctx.march.min_step)
+            break;
+        t += free / (1 + spread);
+    }
+    t_start = t;
+    return true;
+}
+
+bool sphere_trace(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, const float t_min, float *t_clear,
+                  MarchEnd *end)
+{
+    if (ctx.march.stepper == STEPPER_FIXED)
+    {
+        if (t_clear)
+            *t_clear = 0;
+        return sphere_trace_fixed(ctx, orig, dir, pos, steps, end);
+    }
+    return sphere_trace_lipschitz(ctx, orig, dir, pos, steps, t_min, t_clear, end);
+}
+
+// One ray of sphere_trace_packet: march_segment and sphere_trace_lipschitz turned inside out, so that the march can
+// stop at every distance evaluation and go on with its result. The same arithmetic in the same order, so a ray
+// ends exactly where the scalar marcher ends it.
+namespace
+{
+struct LaneMarch
+{
+    size_t ray;
+    float t, t_enter, t_exit, t_prev, step, prev_radius, omega, lo, hi;
+    int budget, refined;
+    bool seeded, clear, refining, exact; // exact: past the cache, as in march_distance
+};
+
+enum LaneState
+{
+    LANE_MARCHING,
+    LANE_HIT,
+    LANE_MISS
+};
+
+struct PacketRays
+{
+    const MarchOptions &march;
+    const Vec3f &orig;
+    const Vec3f *dirs;
+    Vec3f *pos;
+    int *steps;
+    float *t_clear;
+    MarchEnd *end; // null unless MARCH_STATS
+};
+
+LaneState start_segment(LaneMarch &m, const float t, const bool seeded, const PacketRays &rays);
+
+// the segment marched from m.t ends without a hit: a seeded one is marched again from the entry point
+LaneState end_segment(LaneMarch &m, const bool started_inside, const PacketRays &rays)
+{
+    if (m.seeded)
+        return start_segment(m, m.t_enter, false, rays);
+    if (!started_inside)
+    {
+        if (MARCH_STATS && rays.end) // advance() spent the last of the budget before it came here
+            rays.end[m.ray] = m.budget == 0 ? MARCH_STEP_LIMIT : MARCH_EXIT;
+        return LANE_MISS;
+    }
+    rays.pos[m.ray] = rays.orig + rays.dirs[m.ray] * m.t_enter; // the eye is inside the fireball
+    return LANE_HIT;
+}
+
+LaneState start_segment(LaneMarch &m, const float t, const bool seeded, const PacketRays &rays)
+{
+    m.t = m.t_prev = rays.t_clear[m.ray] = t;
+    m.step = m.prev_radius = 0;
+    m.omega = rays.march.relaxation;
+    m.budget = rays.march.max_steps;
+    m.seeded = seeded;
+    m.clear = true;
+    m.refining = false;
+    m.exact = false;
+    return m.budget > 0 && m.t <= m.t_exit ? LANE_MARCHING : end_segment(m, false, rays);
+}
+
+float lane_sample(const LaneMarch &m) { return m.refining ? (m.lo + m.hi) * .5f : m.t; }
+
+// m has sampled d at lane_sample(m)
+LaneState advance(LaneMarch &m, const float d, const PacketRays &rays)
+{
+    rays.steps[m.ray]++;
+    if (m.refining)
+    {
+        float mid = (m.lo + m.hi) * .5f;
+        (d < 0 ? m.hi : m.lo) = mid;
+        if (++m.refined < rays.march.refine_steps)
+            return LANE_MARCHING;
+        rays.pos[m.ray] = rays.orig + rays.dirs[m.ray] * m.hi;
+        return LANE_HIT;
+    }
+    float radius = std::abs(d) / rays.march.lipschitz;
+    float plain = std::max(m.prev_radius, rays.march.min_step);
+    if (m.omega > 1 && m.step > plain && radius + m.prev_radius < m.step)
+    {
+        m.t -= m.step;
+        m.step = plain;
+        m.omega = 1;
+        m.t += m.step;
+    }
+    else if (d < 0 && m.t == m.t_prev)
+        return end_segment(m, true, rays);
+    else if (d < 0)
+    {
+        m.lo = m.t_prev, m.hi = m.t;
+        m.refining = true;
+        m.refined = 0;
+        if (rays.march.refine_steps > 0)
+            return LANE_MARCHING;
+        rays.pos[m.ray] = rays.orig + rays.dirs[m.ray] * m.hi;
+        return LANE_HIT;
+    }
+    else
+    {
+        m.clear = m.clear && d >= rays.march.seed_distance;
+        if (m.clear)
+            rays.t_clear[m.ray] = m.t;
+        m.step = std::max(radius * m.omega, rays.march.min_step);
+        m.prev_radius = radius;
+        m.t_prev = m.t;
+        m.t += m.step;
+    }
+    return --m.budget > 0 && m.t <= m.t_exit ? LANE_MARCHING : end_segment(m, false, rays);
+}
+} // namespace
+
+void sphere_trace_packet(const RenderContext &ctx, const Vec3f &orig, const Vec3f *dirs, const float *t_min, const size_t n,
+                         Vec3f *pos, int *steps, float *t_clear, uint8_t *hit, MarchEnd *end)
+{
+    const PacketRays rays = {ctx.march, orig, dirs, pos, steps, t_clear, MARCH_STATS ? end : nullptr};
+    LaneMarch lanes[NOISE_LANES];
+    size_t active = 0, next = 0;
+    alignas(32) float x[NOISE_LANES], y[NOISE_LANES], z[NOISE_LANES], fbm[NOISE_LANES], footprint[NOISE_LANES];
+    Vec3f p[NOISE_LANES];
+    const bool use_cache = cache_applies(ctx);
+    alignas(32) float cached[NOISE_LANES];
+    uint8_t want[NOISE_LANES], in_cache[NOISE_LANES];
+    for (;;)
+    {
+        while (active < NOISE_LANES && next < n) // repack: rays that are done make room for the next ones
+        {
+            const size_t ray = next++;
+            LaneMarch &m = lanes[active];
+            m.ray = ray;
+            steps[ray] = 0;
+            hit[ray] = false;
+            if (MARCH_STATS && rays.end) // until end_segment() reports a miss
+                rays.end[ray] = MARCH_HIT;
+            float b = orig * dirs[ray], c = orig * orig - ctx.sphere_radius * ctx.sphere_radius;
+            float disc = b * b - c;
+            if (disc < 0)
+            {
+                if (MARCH_STATS && rays.end)
+                    rays.end[ray] = MARCH_EXIT;
+                continue;
+            }
+            m.t_enter = std::max(0.f, -b - std::sqrt(disc)), m.t_exit = -b + std::sqrt(disc);
+            bool seeded = t_min[ray] > m.t_enter && t_min[ray] < m.t_exit;
+            LaneState state = start_segment(m, seeded ? t_min[ray] : m.t_enter, seeded, rays);
+            if (state == LANE_MARCHING)
+                active++;
+            else
+                hit[ray] = state == LANE_HIT;
+        }
+        if (!active)
+            return;
+
+        // The cache answers whole stretches of the rays' marches between two rounds of noise: the lanes short of the
+        // surface go on with cached distances, all of them with one lookup per step, until the cache leaves their
+        // samples to the exact field. The few lanes left short of it take their next step in the round of noise.
+        if (use_cache)
+        {
+            const size_t before = active;
+            for (;;)
+            {
+                size_t wanting = 0;
+                for (size_t k = 0; k < NOISE_LANES; k++)
+                {
+                    want[k] = k < active && !lanes[k].exact;
+                    wanting += want[k];
+                    Vec3f q = want[k] ? object_point(ctx, orig + dirs[lanes[k].ray] * lane_sample(lanes[k])) : Vec3f(0, 0, 0);
+                    x[k] = q.x, y[k] = q.y, z[k] = q.z;
+                }
+                if (wanting < PACKET_MIN_LANES) // a lookup for a lane or two costs more than its share of the noise
+                    break;
+                ctx.sdf_cache->distance8(x, y, z, want, cached, in_cache);
+                for (size_t k = 0; k < active;)
+                {
+                    LaneState state = LANE_MARCHING;
+                    if (want[k] && !in_cache[k])
+                        lanes[k].exact = true;
+                    else if (want[k])
+                        state = advance(lanes[k], cached[k], rays);
+                    if (state == LANE_MARCHING)
+                    {
+                        k++;
+                        continue;
+                    }
+                    hit[lanes[k].ray] = state == LANE_HIT;
+                    active--;
+                    lanes[k] = lanes[active];
+                    want[k] = want[active], in_cache[k] = in_cache[active], cached[k] = cached[active];
+                }
+            }
+            if (active < before && next < n) // refill the lanes first
+                continue;
+            if (!active)
+                return;
+        }
+
+        for (size_t k = 0; k < active; k++)
+        {
+            p[k] = orig + dirs[lanes[k].ray] * lane_sample(lanes[k]);
+            Vec3f q = object_point(ctx, p[k]) * 3.4;
+            x[k] = q.x, y[k] = q.y, z[k] = q.z;
+        }
+        bool lod = false; // the same answer for every lane
+        for (size_t k = 0; k < active && !ctx.noise_grid; k++)
+            lod = noise_footprint(ctx, p[k], footprint[k]);
+        if (ctx.noise_grid)
+            for (size_t k = 0; k < active; k++)
+                fbm[k] = ctx.noise_grid->sample(Vec3f(x[k], y[k], z[k]));
+        else if (active >= PACKET_MIN_LANES)
+        {
+            for (size_t k = active; k < NOISE_LANES; k++) // idle lanes compute something harmless
+                x[k] = y[k] = z[k] = 0, footprint[k] = 1e30f;
+            if (lod)
+                fractal_brownian_motion8(x, y, z, footprint, ctx.octaves, fbm);
+            else
+                fractal_brownian_motion8(x, y, z, fbm);
+        }
+        else // too few lanes left to fill a packet
+            for (size_t k = 0; k < active; k++)
+                fbm[k] = lod ? fractal_brownian_motion(Vec3f(x[k], y[k], z[k]), footprint[k], ctx.octaves) : fractal_brownian_motion(Vec3f(x[k], y[k], z[k]));
+        if (ctx.octave_counter && !ctx.noise_grid)
+        {
+            int octaves = 0;
+            for (size_t k = 0; k < active; k++)
+                octaves += lod ? fbm_octaves(footprint[k], ctx.octaves) : FBM_OCTAVES;
+            ctx.octave_counter->add(octaves, active);
+        }
+
+        for (size_t k = 0; k < active;)
+        {
+            float displacement = -fbm[k] * noise_amplitude;
+            LaneState state = advance(lanes[k], hot_norm(p[k]) - (ctx.sphere_radius + displacement), rays);
+            if (state == LANE_MARCHING)
+            {
+                k++;
+                continue;
+            }
+            hit[lanes[k].ray] = state == LANE_HIT;
+            active--; // the last lane takes this one's place, its sample moves along
+            lanes[k] = lanes[active];
+            p[k] = p[active];
+            fbm[k] = fbm[active];
+        }
+    }
+}
+
+Vec3f distance_field_normal(const RenderContext &ctx, const Vec3f &pos)
+{
+    // finite difference
+    const float eps = 0.1;
+    float d = field_distance(ctx, pos);
+    float nx = field_distance(ctx, pos + Vec3f(eps, 0, 0)) - d;
+    float ny = field_distance(ctx, pos + Vec3f(0, eps, 0)) - d;
+    float nz = field_distance(ctx, pos + Vec3f(0, 0, eps)) - d;
+    return Vec3f(nx, ny, nz).normalize();
+}
@@ -0,0 +1,124 @@
+#ifndef __MARCH_H__
+#define __MARCH_H__
+#include <atomic>
+#include <cstdint>
+#include "geometry.h"
+#include "noise.h"
+#include "noise_grid.h"
+#include "sdf_cache.h"
+#include "volume.h"
+
+const float noise_amplitude = 1.0;
+
+enum Stepper
+{
+    STEPPER_FIXED,    // the original d * 0.1 steps, at least 0.01
+    STEPPER_LIPSCHITZ // sphere_trace_lipschitz
+};
+
+struct MarchOptions
+{
+    Stepper stepper = STEPPER_LIPSCHITZ;
+    int max_steps = 128;      // signed_distance evaluations per ray, not counting the bisection refinement
+    // The noise interpolation is not continuous across cell borders, so there is no true bound: 10 is the one the
+    // fixed stepper has always assumed (steps of d * 0.1), over-relaxation and backtracking make it cheap to keep
+    float lipschitz = 10;
+    float relaxation = 1.6f;  // 1 = plain sphere tracing, below 2
+    float min_step = .005f;   // so rays grazing the surface do not crawl
+    int refine_steps = 6;     // bisection steps once a step lands inside
+    float seed_distance = .1f; // the next frame's rays start where this frame's first came this close to the surface
+    bool packets = true;      // the Lipschitz stepper marches the rays of a tile in packets (sphere_trace_packet)
+};
+
+// fractal_brownian_motion evaluations of signed_distance and the octaves they summed, since the last take(). One per
+// render, shared by the threads of its frames. The noise grid always takes every octave and is not counted.
+struct OctaveCounts
+{
+    uint64_t calls, octaves;
+};
+class OctaveCounter
+{
+public:
+    void add(const int octaves, const size_t calls = 1)
+    {
+        calls_.fetch_add(calls, std::memory_order_relaxed);
+        octaves_.fetch_add(octaves, std::memory_order_relaxed);
+    }
+    OctaveCounts take() { return {calls_.exchange(0), octaves_.exchange(0)}; }
+
+private:
+    std::atomic<uint64_t> calls_{0}, octaves_{0};
+};
+
+// The scene of one frame and how to march it. It is passed down the march and shade path rather than kept in globals,
+// so that frames with different contexts can render at the same time.
+struct RenderContext
+{
+    float sphere_radius = 1;
+    const NoiseGrid *noise_grid = nullptr; // baked fractal_brownian_motion, analytic noise when null
+    Vec3f eye = Vec3f(0, 0, 3);            // the camera, looking down -z
+    float pixel_angle = 0;                 // between neighbouring primary rays, for the noise LOD; 0: no LOD
+    int octaves = FBM_OCTAVES;             // of fractal_brownian_motion, 1 to FBM_OCTAVES
+    // An octave fades out as the sample's footprint (the pixel cone's width there) times noise_lod grows from half a
+    // cell of the octave to a whole one; 0: no LOD, larger: coarser
+    float noise_lod = 0;
+    OctaveCounter *octave_counter = nullptr; // counts the octaves signed_distance evaluates (--lod-stats), null: no count
+    const OccupancyGrid *volume = nullptr; // render the volumetric fire (volume_march) instead of the surface
+    const SdfCache *sdf_cache = nullptr;   // signed_distance away from the surface, analytic when null or beyond it
+    // the fireball turned about the vertical axis by the angle of this cosine and sine, i.e. seen by a camera that
+    // circles it; the noise grid, the occupancy grid and the cache hold the fireball in its own frame
+    float turn_cos = 1, turn_sin = 0;
+    MarchOptions march;
+};
+
+// p in the fireball's own frame
+inline Vec3f object_point(const RenderContext &ctx, const Vec3f &p)
+{
+    return Vec3f(ctx.turn_cos * p.x + ctx.turn_sin * p.z, p.y, ctx.turn_cos * p.z - ctx.turn_sin * p.x);
+}
+
+// Why the march of a ray ended. Recorded only by the instrumented build (cmake -DMARCH_STATS=ON defines
+// TINYKABOOM_MARCH_STATS); otherwise MARCH_STATS is false and the bookkeeping is dead code the compiler drops.
+#ifdef TINYKABOOM_MARCH_STATS
+const bool MARCH_STATS = true;
+#else
+const bool MARCH_STATS = false;
+#endif
+enum MarchEnd : uint8_t
+{
+    MARCH_NONE,       // not marched: a culled tile or a prepass block whose cone missed
+    MARCH_HIT,        // the surface, or in the volume mode the fire turning opaque
+    MARCH_EXIT,       // through the bounding sphere without a hit
+    MARCH_STEP_LIMIT, // ctx.march.max_steps used up without a hit
+    MARCH_ENDS
+};
+
+float signed_distance(const RenderContext &ctx, const Vec3f &p);
+
+// end, if given, receives why the march ended (with MARCH_STATS only)
+bool sphere_trace_fixed(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, MarchEnd *end = nullptr);
+// t_min: where the ray is known to be clear of the surface (checked, the ray is marched again from the start if
+// wrong); t_clear receives how far the ray stayed ctx.march.seed_distance away from the surface, the next frame's seed
+bool sphere_trace_lipschitz(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, const float t_min = 0, float *t_clear = nullptr,
+                            MarchEnd *end = nullptr);
+// the stepper chosen in ctx.march (the fixed stepper ignores t_min and reports t_clear = 0)
+bool sphere_trace(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, Vec3f &pos, int &steps, const float t_min = 0, float *t_clear = nullptr,
+                  MarchEnd *end = nullptr);
+
+// sphere_trace_lipschitz for n rays from a common origin, NOISE_LANES of them at a time: each round of distance
+// evaluations is one fractal_brownian_motion8 call for all the rays in flight, and a ray that hits or misses hands
+// its lane to the next one. Once fewer than PACKET_MIN_LANES rays are left in flight they finish with the scalar
+// noise. With ctx.sdf_cache the lanes short of the surface first run through the stretches the cache answers, as
+// long as enough of them do. pos, steps and t_clear as sphere_trace_lipschitz returns them, hit[k] its result; the
+// same values bit for bit without the cache (with it the two use the cache for different samples).
+const size_t PACKET_MIN_LANES = 3;
+void sphere_trace_packet(const RenderContext &ctx, const Vec3f &orig, const Vec3f *dirs, const float *t_min, const size_t n,
+                         Vec3f *pos, int *steps, float *t_clear, uint8_t *hit, MarchEnd *end = nullptr);
+
+// Marches all rays within half_angle of dir at once, for a conservative start distance shared by all of them.
+// Returns false if none of them can hit the surface.
+bool cone_march(const RenderContext &ctx, const Vec3f &orig, const Vec3f &dir, const float half_angle, float &t_start, int &steps);
+
+Vec3f distance_field_normal(const RenderContext &ctx, const Vec3f &pos); // forward differences, eps = 0.1
+
+#endif //__MARCH_H__
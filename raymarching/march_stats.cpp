@@ -0,0 +1,107 @@
+#include <algorithm>
+#include "framebuffer.h"
+#include "march_stats.h"
+
+namespace
+{
+Vec3f heat(const float x) // black, blue, red, yellow, white for x from 0 to 1
+{
+    const Vec3f stops[5] = {Vec3f(0, 0, 0), Vec3f(0, 0, 1), Vec3f(1, 0, 0), Vec3f(1, 1, 0), Vec3f(1, 1, 1)};
+    float s = std::max(0.f, std::min(1.f, x)) * 4;
+    int k = std::min(3, (int)s);
+    return stops[k] + (stops[k + 1] - stops[k]) * (s - k);
+}
+
+const Vec3f END_COLORS[MARCH_ENDS] = {Vec3f(0, 0, 0), Vec3f(0, 1, 0), Vec3f(0, 0, 1), Vec3f(1, 0, 0)};
+const char *END_NAMES[MARCH_ENDS] = {"not_marched", "hits", "exits", "step_limits"};
+} // namespace
+
+StepSummary summarize_steps(std::vector<int> &steps)
+{
+    double sum = 0;
+    for (int n : steps)
+        sum += n;
+    size_t p99 = steps.size() * 99 / 100;
+    std::nth_element(steps.begin(), steps.begin() + p99, steps.end());
+    return {sum / steps.size(), steps[p99], *std::max_element(steps.begin() + p99, steps.end())};
+}
+
+MarchStatsWriter::MarchStatsWriter(const std::string &prefix, const int max_steps)
+    : prefix_(prefix), max_steps_(max_steps), csv_(std::fopen((prefix + ".csv").c_str(), "w")), json_(std::fopen((prefix + ".json").c_str(), "w")), frames_(0)
+{
+    if (csv_)
+    {
+        std::fprintf(csv_, "frame,pixels");
+        for (const char *name : END_NAMES)
+            std::fprintf(csv_, ",%s", name);
+        std::fprintf(csv_, ",mean_steps,p99_steps,max_steps,march_evaluations,normal_evaluations,seconds\n");
+    }
+    if (json_)
+        std::fputs("[", json_);
+}
+
+MarchStatsWriter::~MarchStatsWriter()
+{
+    if (csv_)
+        std::fclose(csv_);
+    if (json_)
+    {
+        std::fputs(frames_ ? "\n]\n" : "]\n", json_);
+        std::fclose(json_);
+    }
+}
+
+MarchFrameStats MarchStatsWriter::record(const int frame, std::vector<int> &steps, const std::vector<MarchEnd> &ends, const size_t width,
+                                         const size_t height, const int normals_per_hit, const double seconds)
+{
+    MarchFrameStats stats = {frame, width * height, {0, 0, 0, 0}, 0, 0, 0, 0, 0, seconds};
+    FrameBuffer image(width, height, PIXEL_RGB8);
+    std::vector<Vec3f> row(width);
+    for (size_t j = 0; j < height; j++)
+    {
+        for (size_t i = 0; i < width; i++)
+        {
+            stats.ends[ends[i + j * width]]++;
+            stats.march_evaluations += steps[i + j * width];
+            row[i] = heat((float)steps[i + j * width] / max_steps_);
+        }
+        image.store_row(j, row.data());
+    }
+    image.drop_ppm_image(prefix_ + "_steps_" + std::to_string(frame) + ".ppm");
+    for (size_t j = 0; j < height; j++)
+    {
+        for (size_t i = 0; i < width; i++)
+            row[i] = END_COLORS[ends[i + j * width]];
+        image.store_row(j, row.data());
+    }
+    image.drop_ppm_image(prefix_ + "_ends_" + std::to_string(frame) + ".ppm");
+
+    stats.normal_evaluations = (uint64_t)stats.ends[MARCH_HIT] * normals_per_hit;
+    StepSummary summary = summarize_steps(steps);
+    stats.mean_steps = summary.mean;
+    stats.p99_steps = summary.p99;
+    stats.max_steps = summary.max;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (csv_)
+    {
+        std::fprintf(csv_, "%d,%zu", frame, stats.pixels);
+        for (size_t n : stats.ends)
+            std::fprintf(csv_, ",%zu", n);
+        std::fprintf(csv_, ",%.4f,%d,%d,%llu,%llu,%.6f\n", stats.mean_steps, stats.p99_steps, stats.max_steps,
+                     (unsigned long long)stats.march_evaluations, (unsigned long long)stats.normal_evaluations, seconds);
+        std::fflush(csv_);
+    }
+    if (json_)
+    {
+        std::fprintf(json_, "%s\n  {\"frame\": %d, \"pixels\": %zu", frames_ ? "," : "", frame, stats.pixels);
+        for (int e = 0; e < MARCH_ENDS; e++)
+            std::fprintf(json_, ", \"%s\": %zu", END_NAMES[e], stats.ends[e]);
+        std::fprintf(json_, ", \"mean_steps\": %.4f, \"p99_steps\": %d, \"max_steps\": %d, \"march_evaluations\": %llu, \"normal_evaluations\": %llu, \"seconds\": %.6f}",
+                     stats.mean_steps, stats.p99_steps, stats.max_steps, (unsigned long long)stats.march_evaluations,
+                     (unsigned long long)stats.normal_evaluations, seconds);
+        std::fflush(json_);
+    }
+    frames_++;
+    return stats;
+}
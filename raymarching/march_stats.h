@@ -0,0 +1,53 @@
+#ifndef __MARCH_STATS_H__
+#define __MARCH_STATS_H__
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "march.h"
+
+// The signed_distance evaluations per pixel of a frame; shared by --step-stats and --march-stats
+struct StepSummary
+{
+    double mean;
+    int p99, max;
+};
+StepSummary summarize_steps(std::vector<int> &steps); // reorders steps
+
+// What the march of one frame cost and how its rays ended
+struct MarchFrameStats
+{
+    int frame;
+    size_t pixels, ends[MARCH_ENDS]; // pixels by MarchEnd
+    double mean_steps;               // signed_distance evaluations per pixel, the prepass's share included
+    int p99_steps, max_steps;
+    uint64_t march_evaluations, normal_evaluations;
+    double seconds;
+};
+
+// The instrumentation of --march-stats PREFIX, in the MARCH_STATS build. Per frame two images: the evaluations of
+// each pixel on a heat scale from 0 (black) to max_steps (white), PREFIX_steps_N.ppm, and why its march ended,
+// PREFIX_ends_N.ppm (black: not marched, green: hit, blue: through the sphere, red: out of steps). The totals of
+// each frame go to PREFIX.csv and PREFIX.json, in the order the frames finish; frames may come from several groups
+// at once.
+class MarchStatsWriter
+{
+public:
+    MarchStatsWriter(const std::string &prefix, const int max_steps);
+    ~MarchStatsWriter(); // closes the JSON array
+    bool ok() const { return csv_ && json_; }
+
+    // normals_per_hit: signed_distance evaluations of a hit's normal (0 in the volume mode); steps is reordered
+    MarchFrameStats record(const int frame, std::vector<int> &steps, const std::vector<MarchEnd> &ends, const size_t width,
+                           const size_t height, const int normals_per_hit, const double seconds);
+
+private:
+    std::string prefix_;
+    int max_steps_;
+    std::FILE *csv_, *json_;
+    size_t frames_;
+    std::mutex mutex_;
+};
+
+#endif //__MARCH_STATS_H__
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+#include "noise.h"
+
+float lattice_hash(const int32_t n)
+{
+    uint32_t h = n; // integer finalizer (lowbias32), the top 24 bits become the float mantissa
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.f / 16777216.f);
+}
+
+static float lerp(const float v0, const float v1, const float t)
+{
+    return v0 + (v1 - v0) * std::max(0.f, std::min(1.f, t));
+}
+
+float noise(const Vec3f &x)
+{
+    Vec3f p(std::floor(x.x), std::floor(x.y), std::floor(x.z));
+    Vec3f f(x.x - p.x, x.y - p.y, x.z - p.z);
+    f = f * (f * (Vec3f(3.f, 3.f, 3.f) - f * 2.f));
+    int32_t n = (int32_t)((uint32_t)(int32_t)p.x + 57u * (uint32_t)(int32_t)p.y + 113u * (uint32_t)(int32_t)p.z);
+    return lerp(lerp(
+                    lerp(lattice_hash(n + 0), lattice_hash(n + 1), f.x),
+                    lerp(lattice_hash(n + 57), lattice_hash(n + 58), f.x), f.y),
+                lerp(
+                    lerp(lattice_hash(n + 113), lattice_hash(n + 114), f.x),
+                    lerp(lattice_hash(n + 170), lattice_hash(n + 171), f.x), f.y),
+                f.z);
+}
+
+static Vec3f rotate(const Vec3f &v)
+{
+    return Vec3f(Vec3f(0.00f, 0.80f, 0.60f) * v, Vec3f(-0.80f, 0.36f, -0.48f) * v, Vec3f(-0.60f, -0.48f, 0.64f) * v);
+}
+
+float fractal_brownian_motion(const Vec3f &x)
+{
+    Vec3f p = rotate(x);
+    float f = 0;
+    f += 0.5000f * noise(p);
+    p = p * 2.32f;
+    f += 0.2500f * noise(p);
+    p = p * 3.03f;
+    f += 0.1250f * noise(p);
+    p = p * 2.61f;
+    f += 0.0625f * noise(p);
+    return f / 0.9375f;
+}
+
+static float octave_fade(const float footprint, const int o, const int octaves)
+{
+    return o < octaves ? std::max(0.f, std::min(1.f, 2.f - 2.f * footprint * FBM_FREQUENCY[o])) : 0.f;
+}
+
+float fractal_brownian_motion(const Vec3f &x, const float footprint, const int octaves)
+{
+    const float scale[FBM_OCTAVES] = {1.f, 2.32f, 3.03f, 2.61f}, weight[FBM_OCTAVES] = {0.5000f, 0.2500f, 0.1250f, 0.0625f};
+    Vec3f p = rotate(x);
+    float f = 0;
+    for (int o = 0; o < FBM_OCTAVES; o++)
+    {
+        p = p * scale[o]; // times 1 first, as a no-op
+        float fade = octave_fade(footprint, o, octaves);
+        float n = fade > 0 ? noise(p) : 0.f;
+        f += weight[o] * (fade * n + (1 - fade) * 0.5f);
+    }
+    return f / 0.9375f;
+}
+
+int fbm_octaves(const float footprint, const int octaves)
+{
+    int o = 0;
+    while (octave_fade(footprint, o, octaves) > 0)
+        o++;
+    return o;
+}
+
+// The SIMD kernels are written once against a small pack interface (F: float lanes, I: int32 lanes) and do the
+// scalar operations above in the same order, so with -ffp-contract=off they agree with the reference bit for bit.
+#if defined(__AVX2__)
+struct F8
+{
+    __m256 v;
+    F8(const __m256 v) : v(v) {}
+    F8(const float s) : v(_mm256_set1_ps(s)) {}
+    static F8 load(const float *p) { return _mm256_loadu_ps(p); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+struct I8
+{
+    __m256i v;
+    I8(const __m256i v) : v(v) {}
+    I8(const uint32_t s) : v(_mm256_set1_epi32(s)) {}
+};
+inline F8 operator+(const F8 a, const F8 b) { return _mm256_add_ps(a.v, b.v); }
+inline F8 operator-(const F8 a, const F8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline F8 operator*(const F8 a, const F8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline F8 operator/(const F8 a, const F8 b) { return _mm256_div_ps(a.v, b.v); }
+inline F8 min(const F8 a, const F8 b) { return _mm256_min_ps(a.v, b.v); }
+inline F8 max(const F8 a, const F8 b) { return _mm256_max_ps(a.v, b.v); }
+inline F8 floor(const F8 a) { return _mm256_floor_ps(a.v); }
+inline I8 to_int(const F8 a) { return _mm256_cvttps_epi32(a.v); }
+inline F8 to_float(const I8 a) { return _mm256_cvtepi32_ps(a.v); }
+inline I8 operator+(const I8 a, const I8 b) { return _mm256_add_epi32(a.v, b.v); }
+inline I8 operator*(const I8 a, const I8 b) { return _mm256_mullo_epi32(a.v, b.v); }
+inline I8 operator^(const I8 a, const I8 b) { return _mm256_xor_si256(a.v, b.v); }
+inline I8 operator>>(const I8 a, const int k) { return _mm256_srli_epi32(a.v, k); }
+inline bool any_positive(const F8 a) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_GT_OQ)) != 0; }
+#endif
+
+#if defined(__SSE4_1__)
+struct F4
+{
+    __m128 v;
+    F4(const __m128 v) : v(v) {}
+    F4(const float s) : v(_mm_set1_ps(s)) {}
+    static F4 load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+struct I4
+{
+    __m128i v;
+    I4(const __m128i v) : v(v) {}
+    I4(const uint32_t s) : v(_mm_set1_epi32(s)) {}
+};
+inline F4 operator+(const F4 a, const F4 b) { return _mm_add_ps(a.v, b.v); }
+inline F4 operator-(const F4 a, const F4 b) { return _mm_sub_ps(a.v, b.v); }
+inline F4 operator*(const F4 a, const F4 b) { return _mm_mul_ps(a.v, b.v); }
+inline F4 operator/(const F4 a, const F4 b) { return _mm_div_ps(a.v, b.v); }
+inline F4 min(const F4 a, const F4 b) { return _mm_min_ps(a.v, b.v); }
+inline F4 max(const F4 a, const F4 b) { return _mm_max_ps(a.v, b.v); }
+inline F4 floor(const F4 a) { return _mm_floor_ps(a.v); }
+inline I4 to_int(const F4 a) { return _mm_cvttps_epi32(a.v); }
+inline F4 to_float(const I4 a) { return _mm_cvtepi32_ps(a.v); }
+inline I4 operator+(const I4 a, const I4 b) { return _mm_add_epi32(a.v, b.v); }
+inline I4 operator*(const I4 a, const I4 b) { return _mm_mullo_epi32(a.v, b.v); }
+inline I4 operator^(const I4 a, const I4 b) { return _mm_xor_si128(a.v, b.v); }
+inline I4 operator>>(const I4 a, const int k) { return _mm_srli_epi32(a.v, k); }
+inline bool any_positive(const F4 a) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, _mm_setzero_ps())) != 0; }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+template <typename F, typename I>
+static inline F hash_lanes(const I n)
+{
+    I h = n;
+    h = h ^ (h >> 16);
+    h = h * I(0x7feb352du);
+    h = h ^ (h >> 15);
+    h = h * I(0x846ca68bu);
+    h = h ^ (h >> 16);
+    return to_float(h >> 8) * F(1.f / 16777216.f);
+}
+
+template <typename F>
+static inline F lerp_lanes(const F v0, const F v1, const F t)
+{
+    return v0 + (v1 - v0) * max(F(0.f), min(F(1.f), t));
+}
+
+template <typename F, typename I>
+static inline F noise_lanes(const F x, const F y, const F z)
+{
+    F px = floor(x), py = floor(y), pz = floor(z);
+    F fx = x - px, fy = y - py, fz = z - pz;
+    F s = F(0.f) + fz * (F(3.f) - fz * F(2.f)); // the dot product of f and (3 - 2f), z first as in vec operator*
+    s = s + fy * (F(3.f) - fy * F(2.f));
+    s = s + fx * (F(3.f) - fx * F(2.f));
+    fx = fx * s;
+    fy = fy * s;
+    fz = fz * s;
+    I n = to_int(px) + I(57u) * to_int(py) + I(113u) * to_int(pz);
+    return lerp_lanes(lerp_lanes(
+                          lerp_lanes(hash_lanes<F>(n), hash_lanes<F>(n + I(1u)), fx),
+                          lerp_lanes(hash_lanes<F>(n + I(57u)), hash_lanes<F>(n + I(58u)), fx), fy),
+                      lerp_lanes(
+                          lerp_lanes(hash_lanes<F>(n + I(113u)), hash_lanes<F>(n + I(114u)), fx),
+                          lerp_lanes(hash_lanes<F>(n + I(170u)), hash_lanes<F>(n + I(171u)), fx), fy),
+                      fz);
+}
+
+template <typename F, typename I>
+static inline F fbm_lanes(const F x, const F y, const F z)
+{
+    F px = F(0.f) + z * F(0.60f) + y * F(0.80f) + x * F(0.00f); // rotate(), row by row
+    F py = F(0.f) + z * F(-0.48f) + y * F(0.36f) + x * F(-0.80f);
+    F pz = F(0.f) + z * F(0.64f) + y * F(-0.48f) + x * F(-0.60f);
+    F f = F(0.f);
+    f = f + F(0.5000f) * noise_lanes<F, I>(px, py, pz);
+    px = px * F(2.32f), py = py * F(2.32f), pz = pz * F(2.32f);
+    f = f + F(0.2500f) * noise_lanes<F, I>(px, py, pz);
+    px = px * F(3.03f), py = py * F(3.03f), pz = pz * F(3.03f);
+    f = f + F(0.1250f) * noise_lanes<F, I>(px, py, pz);
+    px = px * F(2.61f), py = py * F(2.61f), pz = pz * F(2.61f);
+    f = f + F(0.0625f) * noise_lanes<F, I>(px, py, pz);
+    return f / F(0.9375f);
+}
+
+// fractal_brownian_motion(x, footprint, octaves) for the lanes; an octave is evaluated while any lane needs it, the
+// others weight it 0 as the scalar code does
+template <typename F, typename I>
+static inline F fbm_lanes(const F x, const F y, const F z, const F footprint, const int octaves)
+{
+    const float scale[FBM_OCTAVES] = {1.f, 2.32f, 3.03f, 2.61f}, weight[FBM_OCTAVES] = {0.5000f, 0.2500f, 0.1250f, 0.0625f};
+    F px = F(0.f) + z * F(0.60f) + y * F(0.80f) + x * F(0.00f);
+    F py = F(0.f) + z * F(-0.48f) + y * F(0.36f) + x * F(-0.80f);
+    F pz = F(0.f) + z * F(0.64f) + y * F(-0.48f) + x * F(-0.60f);
+    F f = F(0.f);
+    for (int o = 0; o < FBM_OCTAVES; o++)
+    {
+        px = px * F(scale[o]), py = py * F(scale[o]), pz = pz * F(scale[o]);
+        F fade = o < octaves ? max(F(0.f), min(F(1.f), F(2.f) - F(2.f) * footprint * F(FBM_FREQUENCY[o]))) : F(0.f);
+        F n = any_positive(fade) ? noise_lanes<F, I>(px, py, pz) : F(0.f);
+        f = f + F(weight[o]) * (fade * n + (F(1.f) - fade) * F(0.5f));
+    }
+    return f / F(0.9375f);
+}
+#endif
+
+const char *noise_kernel_name()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE4_1__)
+    return "sse4.1";
+#else
+    return "scalar";
+#endif
+}
+
+void noise8(const float *x, const float *y, const float *z, float *out)
+{
+#if defined(__AVX2__)
+    noise_lanes<F8, I8>(F8::load(x), F8::load(y), F8::load(z)).store(out);
+#elif defined(__SSE4_1__)
+    for (int k = 0; k < NOISE_LANES; k += 4)
+        noise_lanes<F4, I4>(F4::load(x + k), F4::load(y + k), F4::load(z + k)).store(out + k);
+#else
+    for (int k = 0; k < NOISE_LANES; k++)
+        out[k] = noise(Vec3f(x[k], y[k], z[k]));
+#endif
+}
+
+void fractal_brownian_motion8(const float *x, const float *y, const float *z, float *out)
+{
+#if defined(__AVX2__)
+    fbm_lanes<F8, I8>(F8::load(x), F8::load(y), F8::load(z)).store(out);
+#elif defined(__SSE4_1__)
+    for (int k = 0; k < NOISE_LANES; k += 4)
+        fbm_lanes<F4, I4>(F4::load(x + k), F4::load(y + k), F4::load(z + k)).store(out + k);
+#else
+    for (int k = 0; k < NOISE_LANES; k++)
+        out[k] = fractal_brownian_motion(Vec3f(x[k], y[k], z[k]));
+#endif
+}
+
+void fractal_brownian_motion8(const float *x, const float *y, const float *z, const float *footprint, const int octaves, float *out)
+{
+#if defined(__AVX2__)
+    fbm_lanes<F8, I8>(F8::load(x), F8::load(y), F8::load(z), F8::load(footprint), octaves).store(out);
+#elif defined(__SSE4_1__)
+    for (int k = 0; k < NOISE_LANES; k += 4)
+        fbm_lanes<F4, I4>(F4::load(x + k), F4::load(y + k), F4::load(z + k), F4::load(footprint + k), octaves).store(out + k);
+#else
+    for (int k = 0; k < NOISE_LANES; k++)
+        out[k] = fractal_brownian_motion(Vec3f(x[k], y[k], z[k]), footprint[k], octaves);
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef __NOISE_H__
+#define __NOISE_H__
+#include <cstdint>
+#include "geometry.h"
+
+// Value noise on the integer lattice. The lattice hash is integer arithmetic on the cell index (no sin), so the
+// same bits come out of the scalar code and of the SIMD kernels.
+float lattice_hash(const int32_t n); // in [0, 1)
+float noise(const Vec3f &x);
+float fractal_brownian_motion(const Vec3f &x); // four octaves of noise
+
+// Level of detail for a value that stands for a region footprint wide (in units of x): octave o fades out as
+// footprint * FBM_FREQUENCY[o] grows from 1/2 to 1, i.e. as its lattice cells shrink to the footprint, and so do the
+// octaves from the given count on. The faded weight goes to the octave's mean value, 1/2, so that the average of the
+// sum stays; faded out octaves are not evaluated. A footprint of 0 with every octave is fractal_brownian_motion exactly.
+const int FBM_OCTAVES = 4;
+const float FBM_FREQUENCY[FBM_OCTAVES] = {1.f, 2.32f, 7.0296f, 18.347256f}; // lattice cells per unit of x, per octave
+float fractal_brownian_motion(const Vec3f &x, const float footprint, const int octaves);
+int fbm_octaves(const float footprint, const int octaves); // how many of them that evaluates
+
+// The same fractal_brownian_motion for 8 points at once, coordinates in structure-of-arrays form. Uses AVX2 when
+// compiled for it, two SSE4.1 halves otherwise, the scalar code as a last resort; matches the scalar reference.
+const int NOISE_LANES = 8;
+void noise8(const float *x, const float *y, const float *z, float *out);
+void fractal_brownian_motion8(const float *x, const float *y, const float *z, float *out);
+void fractal_brownian_motion8(const float *x, const float *y, const float *z, const float *footprint, const int octaves, float *out);
+const char *noise_kernel_name(); // "avx2", "sse4.1" or "scalar"
+
+#endif //__NOISE_H__
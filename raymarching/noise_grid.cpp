@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include "noise.h"
+#include "noise_grid.h"
+
+NoiseGrid::NoiseGrid(const Vec3f &lo, const Vec3f &hi, const int cells, const size_t max_bytes) : lo_(lo), hi_(hi), cell_(0), bricks_(0), data_(), bake_seconds_(0)
+{
+    const size_t brick_bytes = BRICK * BRICK * BRICK * sizeof(float);
+    bricks_ = std::max(1, (cells + BRICK - 2) / (BRICK - 1));
+    while (bricks_ > 1 && (size_t)bricks_ * bricks_ * bricks_ * brick_bytes > max_bytes)
+        bricks_--;
+    float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    cell_ = extent / resolution();
+    hi_ = lo_ + Vec3f(1, 1, 1) * (cell_ * resolution());
+    data_.resize((size_t)bricks_ * bricks_ * bricks_ * BRICK * BRICK * BRICK);
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    static_assert(BRICK == NOISE_LANES, "a brick row is baked with one call of the 8-wide kernel");
+#pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int bz = 0; bz < bricks_; bz++)
+    {
+        for (int by = 0; by < bricks_; by++)
+        {
+            float x[BRICK], y[BRICK], z[BRICK];
+            for (int bx = 0; bx < bricks_; bx++)
+            {
+                float *brick = &data_[(((size_t)bz * bricks_ + by) * bricks_ + bx) * BRICK * BRICK * BRICK];
+                for (int k = 0; k < BRICK; k++)
+                    x[k] = lo_.x + (bx * (BRICK - 1) + k) * cell_;
+                for (int sz = 0; sz < BRICK; sz++)
+                {
+                    for (int sy = 0; sy < BRICK; sy++)
+                    {
+                        std::fill(y, y + BRICK, lo_.y + (by * (BRICK - 1) + sy) * cell_);
+                        std::fill(z, z + BRICK, lo_.z + (bz * (BRICK - 1) + sz) * cell_);
+                        fractal_brownian_motion8(x, y, z, brick + (sz * BRICK + sy) * BRICK);
+                    }
+                }
+            }
+        }
+    }
+    bake_seconds_ = std::chrono::duration<double>(clock::now() - start).count();
+}
+
+float NoiseGrid::sample(const Vec3f &x) const
+{
+    float u = (x.x - lo_.x) / cell_, v = (x.y - lo_.y) / cell_, w = (x.z - lo_.z) / cell_;
+    const int n = resolution();
+    if (!(u >= 0 && v >= 0 && w >= 0 && u < n && v < n && w < n)) // also catches NaN
+        return fractal_brownian_motion(x);
+    int i = u, j = v, k = w;
+    float fx = u - i, fy = v - j, fz = w - k;
+    const int c = BRICK - 1;
+    const float *p = &data_[(((size_t)(k / c) * bricks_ + j / c) * bricks_ + i / c) * BRICK * BRICK * BRICK + ((k % c) * BRICK + j % c) * BRICK + i % c];
+    const int dy = BRICK, dz = BRICK * BRICK;
+    float c00 = p[0] + (p[1] - p[0]) * fx;
+    float c10 = p[dy] + (p[dy + 1] - p[dy]) * fx;
+    float c01 = p[dz] + (p[dz + 1] - p[dz]) * fx;
+    float c11 = p[dz + dy] + (p[dz + dy + 1] - p[dz + dy]) * fx;
+    float c0 = c00 + (c10 - c00) * fy;
+    float c1 = c01 + (c11 - c01) * fy;
+    return c0 + (c1 - c0) * fz;
+}
+
+void NoiseGrid::report(std::ostream &out) const
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<float> t(0.f, 1.f);
+    const int n = 1 << 18;
+    double max_error = 0, sum_error = 0;
+    for (int s = 0; s < n; s++)
+    {
+        Vec3f x(lo_.x + (hi_.x - lo_.x) * t(gen), lo_.y + (hi_.y - lo_.y) * t(gen), lo_.z + (hi_.z - lo_.z) * t(gen));
+        double e = std::abs(sample(x) - fractal_brownian_motion(x));
+        max_error = std::max(max_error, e);
+        sum_error += e;
+    }
+    out << "noise grid: " << resolution() << "^3 cells in " << bricks_ << "^3 bricks, " << bytes() / (1024. * 1024.)
+        << " MB, baked in " << bake_seconds_ << " s; |grid - fbm| mean " << sum_error / n << ", max " << max_error << std::endl;
+}
@@ -0,0 +1,36 @@
+#ifndef __NOISE_GRID_H__
+#define __NOISE_GRID_H__
+#include <iostream>
+#include <vector>
+#include "geometry.h"
+
+// fractal_brownian_motion baked into a regular grid over a box, sampled with trilinear interpolation; points outside
+// the box fall back to the analytic noise.
+// The grid is stored in bricks of 8^3 samples covering 7^3 cells: neighbouring bricks share their border samples,
+// so the 8 corners of any cell lie in one 2 KB brick and a lookup touches at most a few cache lines.
+class NoiseGrid
+{
+public:
+    static const int BRICK = 8; // samples per brick edge
+
+    // cells is the requested resolution per axis, rounded up to whole bricks and then lowered until the
+    // samples fit into max_bytes
+    NoiseGrid(const Vec3f &lo, const Vec3f &hi, const int cells, const size_t max_bytes);
+
+    float sample(const Vec3f &x) const;
+    int resolution() const { return bricks_ * (BRICK - 1); } // cells per axis
+    size_t bytes() const { return data_.size() * sizeof(float); }
+    double bake_seconds() const { return bake_seconds_; }
+
+    // bake time, memory and the interpolation error against the analytic noise at random points of the box
+    void report(std::ostream &out) const;
+
+private:
+    Vec3f lo_, hi_;
+    float cell_;  // edge of a cell (cubic, the box is widened to a cube if needed)
+    int bricks_;  // per axis
+    std::vector<float> data_;
+    double bake_seconds_;
+};
+
+#endif //__NOISE_GRID_H__
@@ -1,14 +1,30 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "geometry.h"
-
-float sphere_radius = 1;
-const float noise_amplitude = 1.0;
+#include "framebuffer.h"
+#include "arena.h"
+#include "noise_grid.h"
+#include "sdf_cache.h"
+#include "volume.h"
+#include "march.h"
+#include "bench.h"
+#include "sdf_program.h"
+#include "video.h"
+#include "scheduler.h"
+#include "manifest.h"
+#include "march_stats.h"
 
 template <typename T>
 inline T lerp(const T &v0, const T &v1, float t) // Linear Interpolation
@@ -17,46 +33,6 @@ inline T lerp(const T &v0, const T &v1, float t) // Linear Interpolation
     return v0 + (v1 - v0) * std::max(0.f, std::min(1.f, t));
 }
 
-float hash(const float n)
-{
-    float x = sin(n) * 43758.5453f;
-    return x - floor(x);
-}
-
-float noise(const Vec3f &x)
-{
-    Vec3f p(floor(x.x), floor(x.y), floor(x.z));
-    Vec3f f(x.x - p.x, x.y - p.y, x.z - p.z);
-    f = f * (f * (Vec3f(3.f, 3.f, 3.f) - f * 2.f));
-    float n = p * Vec3f(1.f, 57.f, 113.f);
-    return lerp(lerp(
-                    lerp(hash(n + 0.f), hash(n + 1.f), f.x),
-                    lerp(hash(n + 57.f), hash(n + 58.f), f.x), f.y),
-                lerp(
-                    lerp(hash(n + 113.f), hash(n + 114.f), f.x),
-                    lerp(hash(n + 170.f), hash(n + 171.f), f.x), f.y),
-                f.z);
-}
-
-Vec3f rotate(const Vec3f &v)
-{
-    return Vec3f(Vec3f(0.00, 0.80, 0.60) * v, Vec3f(-0.80, 0.36, -0.48) * v, Vec3f(-0.60, -0.48, 0.64) * v);
-}
-
-float fractal_brownian_motion(const Vec3f &x)
-{
-    Vec3f p = rotate(x);
-    float f = 0;
-    f += 0.5000 * noise(p);
-    p = p * 2.32;
-    f += 0.2500 * noise(p);
-    p = p * 3.03;
-    f += 0.1250 * noise(p);
-    p = p * 2.61;
-    f += 0.0625 * noise(p);
-    return f / 0.9375;
-}
-
 Vec3f fire_color(const float d)
 {
     const Vec3f yellow(1.7, 1.3, 1.0); // note that the color is "hot", i.e. has components >1
@@ -75,40 +51,642 @@ Vec3f fire_color(const float d)
     return lerp(orange, yellow, x * 4.f - 3.f);
 }
 
-float signed_distance(const Vec3f &p)
+// where the previous frame's rays were still clear of the surface, per pixel, for seeding the next one
+struct DepthHistory
+{
+    std::vector<float> depth; // along the primary ray, negative for a miss
+    float radius = 0;         // the sphere_radius of the frame it was rendered with
+    bool valid = false;
+};
+
+const size_t CULL_TILE = 16; // edge of the screen tiles classified against the bounding sphere
+
+// The z of every primary ray before normalization, for an image height pixels high seen under fov; computed once per
+// frame rather than in each primary_ray
+float primary_ray_z(const size_t height, const float fov)
+{
+    return -(double)height / (2. * std::tan(fov / 2.));
+}
+
+Vec3f primary_ray(const float x, const float y, const size_t width, const size_t height, const float dir_z)
+{
+    float dir_x = x - width / 2.;
+    float dir_y = -y + height / 2.;
+    return Vec3f(dir_x, dir_y, dir_z).normalize();
+}
+
+// The primary rays through the pixel centers of [x0, x1) x [y0, y1) lie in a cone around the block's middle ray
+// that reaches out to the corner pixels; returns its half-angle
+float block_cone(const size_t x0, const size_t y0, const size_t x1, const size_t y1, const size_t width, const size_t height,
+                 const float dir_z, Vec3f &axis)
+{
+    axis = primary_ray((x0 + x1) * .5f, (y0 + y1) * .5f, width, height, dir_z);
+    float angle = 0;
+    const float xs[2] = {x0 + .5f, x1 - .5f}, ys[2] = {y0 + .5f, y1 - .5f};
+    for (float x : xs)
+        for (float y : ys)
+            angle = std::max(angle, std::acos(std::min(1.f, axis * primary_ray(x, y, width, height, dir_z))));
+    return angle;
+}
+
+// Whether a primary ray through a pixel center of [x0, x1) x [y0, y1) can hit the sphere of the given radius around
+// the origin. The sphere seen from the eye fills a cone too; the two cones can only meet if the angle between their
+// axes is below the sum of the half-angles.
+bool tile_may_hit(const size_t x0, const size_t y0, const size_t x1, const size_t y1, const size_t width, const size_t height,
+                  const float dir_z, const Vec3f &eye, const float radius)
+{
+    float distance = eye.norm();
+    if (distance <= radius)
+        return true;
+    Vec3f axis;
+    float tile_angle = block_cone(x0, y0, x1, y1, width, height, dir_z, axis);
+    float sphere_angle = std::asin(radius / distance);
+    float between = std::acos(std::max(-1.f, std::min(1.f, axis * (-eye) * (1.f / distance))));
+    return between <= tile_angle + sphere_angle + 1e-4f;
+}
+
+// What marching the rays of a tile roughly costs: the length of its middle ray inside the sphere of the given radius,
+// where the marcher works, plus one for the tile itself
+float tile_cost(const size_t x0, const size_t y0, const size_t x1, const size_t y1, const size_t width, const size_t height,
+                const float dir_z, const Vec3f &eye, const float radius)
+{
+    Vec3f dir = primary_ray((x0 + x1) * .5f, (y0 + y1) * .5f, width, height, dir_z);
+    float b = eye * dir, disc = b * b - (eye * eye - radius * radius);
+    return 1 + (disc > 0 ? 2 * std::sqrt(disc) : 0.f);
+}
+
+// Renders one frame and returns the share of the pixels that were filled with the background without marching:
+// the frame is split into tiles of CULL_TILE x CULL_TILE, tiles no ray of which can reach the bounding sphere are
+// skipped. The others go to the threads through a TileScheduler (the caller's, to keep its busy times), the longest
+// chords through the bounding sphere first. The rays of a tile are marched together, in packets unless
+// ctx.march.packets is off.
+// With a prepass, blocks of prepass x prepass pixels are first cone marched together: the rays of a block start at
+// the block's common start distance, or are not marched at all if the cone missed.
+// steps, if given, receives the signed_distance evaluations of each pixel's primary ray, row-major. With a history,
+// rays that hit last frame start where they were still ctx.march.seed_distance away from the surface; the surface has
+// moved by the change of the radius since, so seeding stops when that is no longer well below seed_distance.
+// ends, if given, receives why each pixel's march ended, row-major (with MARCH_STATS only).
+double render_frame(const RenderContext &ctx, FrameBuffer &fb, const float fov, int *steps = nullptr, const bool cull = true, DepthHistory *history = nullptr,
+                    const size_t prepass = 0, TileScheduler *scheduler = nullptr, MarchEnd *ends = nullptr)
+{
+    if (!MARCH_STATS)
+        ends = nullptr;
+    const size_t width = fb.w, height = fb.h;
+    const float dir_z = primary_ray_z(height, fov);
+    const Vec3f eye = ctx.eye;
+    const Vec3f background(0.2, 0.7, 0.8);
+    const size_t tiles_y = (height + CULL_TILE - 1) / CULL_TILE, tiles_x = (width + CULL_TILE - 1) / CULL_TILE;
+    TileScheduler own;
+    TileScheduler &tiles = scheduler ? *scheduler : own;
+    size_t skipped = 0;
+    float *depth = nullptr;
+    bool seeded = false;
+    if (history)
+    {
+        seeded = history->valid && history->depth.size() == width * height && std::abs(ctx.sphere_radius - history->radius) < ctx.march.seed_distance / 2;
+        history->depth.resize(width * height);
+        depth = history->depth.data();
+    }
+    struct CoarsePixel
+    {
+        float start; // negative: the block's cone missed
+        int steps;
+    } *coarse = nullptr;
+    const size_t coarse_w = prepass ? (width + prepass - 1) / prepass : 0, coarse_h = prepass ? (height + prepass - 1) / prepass : 0;
+#pragma omp parallel reduction(+ : skipped)
+    {
+        frame_arena().reset();         // each thread owns its arena, the previous frame's rows are dead
+        ArenaVector<Vec3f> row(CULL_TILE); // per-thread float row of a tile, converted into fb once complete
+        // per-thread buffers for the rays of a tile that get marched, in pixel order
+        ArenaVector<Vec3f> dirs(CULL_TILE * CULL_TILE), ray_pos(CULL_TILE * CULL_TILE);
+        ArenaVector<float> t_min(CULL_TILE * CULL_TILE), ray_clear(CULL_TILE * CULL_TILE);
+        ArenaVector<int> ray_steps(CULL_TILE * CULL_TILE);
+        ArenaVector<uint8_t> ray_hit(CULL_TILE * CULL_TILE);
+        ArenaVector<MarchEnd> ray_end(ends ? CULL_TILE * CULL_TILE : 0);
+        if (prepass)
+        {
+#pragma omp single
+            coarse = static_cast<CoarsePixel *>(frame_arena().allocate(coarse_w * coarse_h * sizeof(CoarsePixel), alignof(CoarsePixel)));
+#pragma omp for schedule(dynamic)
+            for (size_t c = 0; c < coarse_w * coarse_h; c++)
+            {
+                const size_t x0 = c % coarse_w * prepass, y0 = c / coarse_w * prepass;
+                const size_t x1 = std::min(width, x0 + prepass), y1 = std::min(height, y0 + prepass);
+                Vec3f axis;
+                float angle = block_cone(x0, y0, x1, y1, width, height, dir_z, axis);
+                coarse[c].steps = 0;
+                if (!tile_may_hit(x0, y0, x1, y1, width, height, dir_z, eye, ctx.sphere_radius) || !cone_march(ctx, eye, axis, angle, coarse[c].start, coarse[c].steps))
+                    coarse[c].start = -1;
+            }
+        }
+#pragma omp single
+        {
+            std::vector<float> &costs = tiles.costs();
+            costs.resize(tiles_x * tiles_y);
+            for (size_t t = 0; t < costs.size(); t++)
+            {
+                const size_t x0 = t % tiles_x * CULL_TILE, y0 = t / tiles_x * CULL_TILE;
+                const size_t x1 = std::min(width, x0 + CULL_TILE), y1 = std::min(height, y0 + CULL_TILE);
+                costs[t] = !cull || tile_may_hit(x0, y0, x1, y1, width, height, dir_z, eye, ctx.sphere_radius) ? tile_cost(x0, y0, x1, y1, width, height, dir_z, eye, ctx.sphere_radius) : 0;
+            }
+#ifdef _OPENMP
+            tiles.start(omp_get_num_threads());
+#else
+            tiles.start(1);
+#endif
+        }
+#ifdef _OPENMP
+        const size_t thread = omp_get_thread_num();
+#else
+        const size_t thread = 0;
+#endif
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t tile;
+        while (tiles.next(thread, tile))
+        {
+            const size_t x0 = tile % tiles_x * CULL_TILE, y0 = tile / tiles_x * CULL_TILE;
+            const size_t x1 = std::min(width, x0 + CULL_TILE), y1 = std::min(height, y0 + CULL_TILE);
+            if (tiles.costs()[tile] == 0) // no ray of the tile can reach the bounding sphere
+            {
+                std::fill(row.begin(), row.begin() + (x1 - x0), background);
+                for (size_t j = y0; j < y1; j++)
+                {
+                    fb.store_span(x0, j, row.data(), x1 - x0);
+                    if (steps)
+                        std::fill(steps + x0 + j * width, steps + x1 + j * width, 0);
+                    if (depth)
+                        std::fill(depth + x0 + j * width, depth + x1 + j * width, -1.f);
+                    if (ends)
+                        std::fill(ends + x0 + j * width, ends + x1 + j * width, MARCH_NONE);
+                }
+                skipped += (x1 - x0) * (y1 - y0);
+                continue;
+            }
+            if (ctx.volume) // the volumetric fire, ray by ray; the prepass and the history only serve the surface
+            {
+                for (size_t j = y0; j < y1; j++)
+                {
+                    for (size_t i = x0; i < x1; i++)
+                    {
+                        int samples;
+                        row[i - x0] = volume_march(ctx, eye, primary_ray(i + 0.5, j + 0.5, width, height, dir_z), background, fire_color, samples,
+                                                   ends ? ends + i + j * width : nullptr);
+                        if (steps)
+                            steps[i + j * width] = samples;
+                        if (depth)
+                            depth[i + j * width] = -1;
+                    }
+                    fb.store_span(x0, j, row.data(), x1 - x0);
+                }
+                continue;
+            }
+            // the rays of the tile that need marching: all but those of prepass blocks whose cone missed
+            size_t rays = 0;
+            for (size_t j = y0; j < y1; j++)
+                for (size_t i = x0; i < x1; i++)
+                {
+                    const CoarsePixel *block = coarse ? &coarse[j / prepass * coarse_w + i / prepass] : nullptr;
+                    if (block && block->start < 0)
+                        continue;
+                    float seed = seeded && depth[i + j * width] > 0 ? depth[i + j * width] : 0.f;
+                    dirs[rays] = primary_ray(i + 0.5, j + 0.5, width, height, dir_z);
+                    t_min[rays++] = std::max(seed, block ? block->start : 0.f);
+                }
+            if (ctx.march.packets && ctx.march.stepper == STEPPER_LIPSCHITZ)
+                sphere_trace_packet(ctx, eye, dirs.data(), t_min.data(), rays, ray_pos.data(), ray_steps.data(), ray_clear.data(), ray_hit.data(),
+                                    ends ? ray_end.data() : nullptr);
+            else
+                for (size_t r = 0; r < rays; r++)
+                {
+                    ray_clear[r] = -1;
+                    ray_hit[r] = sphere_trace(ctx, eye, dirs[r], ray_pos[r], ray_steps[r], t_min[r], &ray_clear[r], ends ? &ray_end[r] : nullptr);
+                }
+            for (size_t j = y0, r = 0; j < y1; j++)
+            {
+                for (size_t i = x0; i < x1; i++)
+                {
+                    const CoarsePixel *block = coarse ? &coarse[j / prepass * coarse_w + i / prepass] : nullptr;
+                    const bool marched = !(block && block->start < 0);
+                    if (!marched)
+                        skipped++;
+                    const bool is_hit = marched && ray_hit[r];
+                    if (steps) // the block's cone march is shared by its pixels
+                        steps[i + j * width] = (marched ? ray_steps[r] : 0) + (block ? (block->steps + prepass * prepass - 1) / (prepass * prepass) : 0);
+                    if (depth)
+                        depth[i + j * width] = is_hit ? ray_clear[r] : -1.f;
+                    if (ends)
+                        ends[i + j * width] = marched ? ray_end[r] : MARCH_NONE;
+                    if (is_hit)
+                    {
+                        const Vec3f &hit = ray_pos[r];
+                        float noise_level = (ctx.sphere_radius - hit.norm()) / noise_amplitude;
+                        Vec3f light_dir = (Vec3f(10, 10, 10) - hit).normalize();
+                        float light_intensity = std::max(0.4f, light_dir * distance_field_normal(ctx, hit));
+                        row[i - x0] = fire_color((-.2 + noise_level) * 2) * light_intensity;
+                    }
+                    else
+                    {
+                        row[i - x0] = background;
+                    }
+                    r += marched;
+                }
+                fb.store_span(x0, j, row.data(), x1 - x0);
+            }
+        }
+        tiles.add_busy(thread, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    if (history)
+    {
+        history->radius = ctx.sphere_radius;
+        history->valid = true;
+    }
+    return (double)skipped / (width * height);
+}
+
+// The axis-aligned box around the primary rays through the pixel centers of [x0, x1) x [y0, y1) between the
+// depths near and far along the view axis; the rays are straight, so the corner rays span it
+void frustum_box(const size_t x0, const size_t y0, const size_t x1, const size_t y1, const size_t width, const size_t height,
+                 const float dir_z, const Vec3f &eye, const float near, const float far, Vec3f &lo, Vec3f &hi)
 {
-    float displacement = -fractal_brownian_motion(p * 3.4) * noise_amplitude;
-    return p.norm() - (sphere_radius + displacement);
+    lo = Vec3f(1e30f, 1e30f, 1e30f), hi = Vec3f(-1e30f, -1e30f, -1e30f);
+    const float xs[2] = {x0 + .5f, x1 - .5f}, ys[2] = {y0 + .5f, y1 - .5f}, depths[2] = {near, far};
+    for (float x : xs)
+        for (float y : ys)
+            for (float depth : depths)
+            {
+                Vec3f dir = primary_ray(x, y, width, height, dir_z);
+                Vec3f p = eye + dir * (depth / -dir.z);
+                lo = Vec3f(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+                hi = Vec3f(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+            }
 }
 
-bool sphere_trace(const Vec3f &orig, const Vec3f &dir, Vec3f &pos)
+const int SCENE_SLABS = 16;         // depth slabs per tile, each with its own pruned program
+const float SCENE_FIRST_SLAB = .5f; // depth of the first one, the others grow geometrically like the tile's footprint
+
+// Renders a scene read at runtime with the bytecode interpreter. Each band of CULL_TILE rows gets the program pruned
+// to its rays' box, each tile of the band that one pruned again to its own box, and each depth slab of the tile the
+// tile's program; tiles and slabs the intervals prove empty are skipped. Rays march in packets of NOISE_LANES
+// neighbouring pixels, out to depth far. A packet runs the program of the nearest slab one of its rays is in, and only
+// the rays in that slab move; steps stop at the slab's end, because the members of unions pruned for having no
+// surface in the slab may well have one in the next. Returns the mean length of the slab programs the packets ran,
+// empty_tiles receives the share of the tiles that were empty.
+double render_scene(FrameBuffer &fb, const float fov, const SdfProgram &scene, const bool prune, const float far, const int max_steps, double &empty_tiles)
 {
-    if (orig * orig - pow(orig * dir, 2) > pow(sphere_radius, 2))
-        return false;
-    pos = orig;
-    for (size_t i = 0; i < 128; i++)
+    const size_t width = fb.w, height = fb.h, L = NOISE_LANES;
+    const float dir_z = primary_ray_z(height, fov);
+    const Vec3f eye(0, 0, 3);
+    const Vec3f background(0.2, 0.7, 0.8);
+    const float eps = 1e-3f, step_scale = 1.f / scene.lipschitz();
+    const size_t bands = (height + CULL_TILE - 1) / CULL_TILE, tiles_per_band = (width + CULL_TILE - 1) / CULL_TILE;
+    const int slabs = prune ? SCENE_SLABS : 1;
+    float slab_depth[SCENE_SLABS + 1] = {0}; // slab k spans [slab_depth[k], slab_depth[k + 1]]
+    for (int k = 1; k <= slabs; k++)
+        slab_depth[k] = slabs == 1 ? far : SCENE_FIRST_SLAB * std::pow(far / SCENE_FIRST_SLAB, (k - 1.f) / (slabs - 1));
+    double instructions = 0, evaluations = 0;
+    size_t empty = 0;
+#pragma omp parallel reduction(+ : instructions, evaluations, empty)
     {
-        float d = signed_distance(pos);
-        if (d < 0)
-            return true;
-        pos = pos + dir * std::max(d * 0.1f, .01f);
+        frame_arena().reset();
+        ArenaVector<Vec3f> band_colors(width * CULL_TILE);
+        SdfProgram band_program, tile_program, slab_programs[SCENE_SLABS]; // their storage is reused from tile to tile
+        bool slab_empty[SCENE_SLABS];
+#pragma omp for schedule(dynamic)
+        for (size_t band = 0; band < bands; band++)
+        {
+            const size_t y0 = band * CULL_TILE, y1 = std::min(height, y0 + CULL_TILE);
+            Vec3f lo, hi;
+            frustum_box(0, y0, width, y1, width, height, dir_z, eye, 0, far, lo, hi);
+            const SdfProgram *band_scene = &scene;
+            if (prune)
+            {
+                scene.prune(lo, hi, band_program);
+                band_scene = &band_program;
+            }
+            for (size_t t = 0; t < tiles_per_band; t++)
+            {
+                const size_t x0 = t * CULL_TILE, x1 = std::min(width, x0 + CULL_TILE);
+                const SdfProgram *programs[SCENE_SLABS] = {band_scene};
+                slab_empty[0] = false;
+                if (prune)
+                {
+                    frustum_box(x0, y0, x1, y1, width, height, dir_z, eye, 0, far, lo, hi);
+                    bool tile_empty = band_scene->prune(lo, hi, tile_program).lo > eps;
+                    for (int k = 0; k < slabs; k++)
+                    {
+                        frustum_box(x0, y0, x1, y1, width, height, dir_z, eye, slab_depth[k], slab_depth[k + 1], lo, hi);
+                        slab_empty[k] = tile_empty || tile_program.prune(lo, hi, slab_programs[k]).lo > eps;
+                        programs[k] = &slab_programs[k];
+                    }
+                    if (tile_empty)
+                    {
+                        empty++;
+                        for (size_t j = y0; j < y1; j++)
+                            std::fill(band_colors.begin() + (j - y0) * width + x0, band_colors.begin() + (j - y0) * width + x1, background);
+                        continue;
+                    }
+                }
+                for (size_t j = y0; j < y1; j++)
+                {
+                    for (size_t i0 = x0; i0 < x1; i0 += L)
+                    {
+                        Vec3f dir[NOISE_LANES];
+                        float t_ray[NOISE_LANES], depth_per_t[NOISE_LANES];
+                        float px[NOISE_LANES], py[NOISE_LANES], pz[NOISE_LANES], d[NOISE_LANES];
+                        int slab[NOISE_LANES]; // slabs for marching rays, -1 after a hit, slabs past the last one after a miss
+                        for (size_t l = 0; l < L; l++)
+                        {
+                            dir[l] = primary_ray(std::min(i0 + l, x1 - 1) + .5f, j + .5f, width, height, dir_z);
+                            t_ray[l] = 0;
+                            depth_per_t[l] = -dir[l].z;
+                            slab[l] = i0 + l < x1 ? 0 : slabs; // lanes past the tile never march
+                        }
+                        for (int step = 0; step < max_steps;)
+                        {
+                            int current = slabs;
+                            for (size_t l = 0; l < L; l++)
+                                if (slab[l] >= 0)
+                                    current = std::min(current, slab[l]);
+                            if (current == slabs)
+                                break;
+                            const float slab_end = slab_depth[current + 1];
+                            if (!slab_empty[current])
+                            {
+                                for (size_t l = 0; l < L; l++)
+                                {
+                                    Vec3f p = eye + dir[l] * t_ray[l];
+                                    px[l] = p.x, py[l] = p.y, pz[l] = p.z;
+                                }
+                                programs[current]->eval(px, py, pz, d);
+                                instructions += programs[current]->size();
+                                evaluations++;
+                                step++;
+                            }
+                            for (size_t l = 0; l < L; l++)
+                            {
+                                if (slab[l] != current)
+                                    continue;
+                                if (!slab_empty[current] && d[l] < eps)
+                                {
+                                    slab[l] = -1;
+                                    continue;
+                                }
+                                if (!slab_empty[current])
+                                    t_ray[l] += d[l] * step_scale;
+                                if (slab_empty[current] || t_ray[l] * depth_per_t[l] >= slab_end)
+                                {
+                                    t_ray[l] = slab_end / depth_per_t[l];
+                                    slab[l]++;
+                                }
+                            }
+                        }
+                        for (size_t l = 0; l < L && i0 + l < x1; l++)
+                        {
+                            Vec3f &color = band_colors[(j - y0) * width + i0 + l];
+                            if (slab[l] >= 0)
+                            {
+                                color = background;
+                                continue;
+                            }
+                            // tetrahedral normal, the four taps in one batch, with the program of the hit's slab
+                            const float h = .01f;
+                            const Vec3f k[4] = {Vec3f(1, -1, -1), Vec3f(-1, -1, 1), Vec3f(-1, 1, -1), Vec3f(1, 1, 1)};
+                            Vec3f hit = eye + dir[l] * t_ray[l];
+                            const float depth = t_ray[l] * depth_per_t[l];
+                            int s = 0;
+                            while (s + 1 < slabs && slab_depth[s + 1] <= depth)
+                                s++;
+                            for (size_t m = 0; m < L; m++)
+                            {
+                                Vec3f p = hit + k[m % 4] * h;
+                                px[m] = p.x, py[m] = p.y, pz[m] = p.z;
+                            }
+                            programs[s]->eval(px, py, pz, d);
+                            Vec3f normal = (k[0] * d[0] + k[1] * d[1] + k[2] * d[2] + k[3] * d[3]).normalize();
+                            Vec3f light_dir = (Vec3f(10, 10, 10) - hit).normalize();
+                            color = Vec3f(.8, .8, .8) * std::max(0.4f, light_dir * normal);
+                        }
+                    }
+                }
+            }
+            for (size_t j = y0; j < y1; j++)
+                fb.store_row(j, band_colors.data() + (j - y0) * width);
+        }
+    }
+    empty_tiles = (double)empty / (bands * tiles_per_band);
+    return evaluations ? instructions / evaluations : 0;
+}
+
+// the time each thread of the frame spent on its tiles; the rest of the frame it waited for the others
+void report_busy(TileScheduler &scheduler, const int frame, std::ostream &out)
+{
+    std::vector<double> busy = scheduler.busy();
+    scheduler.clear_busy();
+    double sum = 0, most = 0;
+    out << "frame " << frame << ": busy ms per thread";
+    for (double seconds : busy)
+    {
+        out << " " << std::round(seconds * 1e4) / 10;
+        sum += seconds;
+        most = std::max(most, seconds);
     }
-    return false;
+    out << ", max / mean " << most * busy.size() / sum << std::endl;
+}
+
+void report_steps(std::vector<int> &steps, const int frame, std::ostream &out)
+{
+    StepSummary summary = summarize_steps(steps);
+    out << "frame " << frame << ": steps per pixel mean " << summary.mean << ", p99 " << summary.p99 << ", max " << summary.max << std::endl;
 }
 
-Vec3f distance_field_normal(const Vec3f &pos)
+// per-channel RMSE and the share of pixels that changed, on the stored (possibly quantized) colors
+void report_image_error(const FrameBuffer &fb, const FrameBuffer &reference, const std::string &what, std::ostream &out)
 {
-    // finite difference
-    const float eps = 0.1;
-    float d = signed_distance(pos);
-    float nx = signed_distance(pos + Vec3f(eps, 0, 0)) - d;
-    float ny = signed_distance(pos + Vec3f(0, eps, 0)) - d;
-    float nz = signed_distance(pos + Vec3f(0, 0, eps)) - d;
-    return Vec3f(nx, ny, nz).normalize();
+    std::vector<Vec3f> a(fb.w), b(fb.w);
+    double sum = 0;
+    size_t changed = 0;
+    for (size_t j = 0; j < fb.h; j++)
+    {
+        fb.load_row(j, a.data());
+        reference.load_row(j, b.data());
+        for (size_t i = 0; i < fb.w; i++)
+        {
+            Vec3f d = a[i] - b[i];
+            sum += d * d;
+            changed += d.x != 0 || d.y != 0 || d.z != 0;
+        }
+    }
+    out << what << ": rmse " << std::sqrt(sum / (3. * fb.w * fb.h)) << ", " << 100. * changed / (fb.w * fb.h) << "% of the pixels differ" << std::endl;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    PixelFormat format = PIXEL_RGB8; // the frames only go to 8 bit PPM, no need to keep floats around
+    bool alloc_stats = false;
+    MarchOptions march; // every render's, from the command line
+    int octaves = FBM_OCTAVES;
+    float noise_lod = 0;
+    bool lod_stats = false;
+    int grid_cells = 0;           // 0: analytic noise
+    size_t grid_budget_mb = 512;
+    bool grid_error = false;
+    bool step_stats = false;
+    std::string march_stats_prefix; // per-frame step and termination images and totals, MARCH_STATS builds only
+    bool cull = true;
+    bool cull_stats = false;
+    bool temporal = false; // seed each frame's rays from the frame before, so that a frame depends on its predecessors
+    size_t prepass = 0;
+    int frame_groups = 1;   // frames rendered at the same time
+    std::string scene_file; // render this runtime scene instead of the fireball
+    bool prune = true;
+    std::string output;     // a video file instead of the PPM frames, "-": Y4M to standard output
+    int jpeg_quality = 90;
+    bool pipeline_stats = false;
+    bool sched_stats = false;
+    bool lod_error = false;
+    int views = 0;          // a turntable of the middle frame from this many cameras instead of the animation
+    // 0: no SDF cache for the views. The cache only stands in for the field away from the surface, so the hits and
+    // normals stay on the exact field; the march takes other steps to them, which moves hits within the march's eps
+    // and changes a few pixels slightly (see the rmse against the analytic view the run reports)
+    int cache_cells = 0;
+    float cache_band = .1f; // how far beyond the exact shell around the surface the bricks reach
+    int volume_cells = 0;   // 0: the surface, otherwise the volumetric fire over an occupancy grid of that resolution
+    int first_frame = 0, last_frame = -1; // -1: to the end
+    int shard = 0, shards = 1;            // render the frames with frame % shards == shard
+    bool resume = false;
+    std::string manifest_file;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--format" && i + 1 < argc && parse_pixel_format(argv[i + 1], format))
+            i++;
+        else if (std::string(argv[i]) == "--alloc-stats")
+            alloc_stats = true;
+        else if (std::string(argv[i]) == "--noise-grid" && i + 1 < argc)
+            grid_cells = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--noise-grid-budget" && i + 1 < argc)
+            grid_budget_mb = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--noise-grid-error")
+            grid_error = true;
+        else if (std::string(argv[i]) == "--stepper" && i + 1 < argc && (std::string(argv[i + 1]) == "fixed" || std::string(argv[i + 1]) == "lipschitz"))
+            march.stepper = std::string(argv[++i]) == "fixed" ? STEPPER_FIXED : STEPPER_LIPSCHITZ;
+        else if (std::string(argv[i]) == "--max-steps" && i + 1 < argc)
+            march.max_steps = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--lipschitz" && i + 1 < argc)
+            march.lipschitz = std::max(1e-3, atof(argv[++i]));
+        else if (std::string(argv[i]) == "--relaxation" && i + 1 < argc)
+            march.relaxation = std::max(1., std::min(1.99, atof(argv[++i])));
+        else if (std::string(argv[i]) == "--octaves" && i + 1 < argc)
+            octaves = std::max(1, std::min(FBM_OCTAVES, atoi(argv[++i])));
+        else if (std::string(argv[i]) == "--noise-lod" && i + 1 < argc)
+            noise_lod = std::max(0., atof(argv[++i]));
+        else if (std::string(argv[i]) == "--lod-stats")
+            lod_stats = true;
+        else if (std::string(argv[i]) == "--lod-error")
+            lod_error = true;
+        else if (std::string(argv[i]) == "--volume")
+            volume_cells = 32;
+        else if (std::string(argv[i]) == "--volume-cells" && i + 1 < argc)
+            volume_cells = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--views" && i + 1 < argc)
+            views = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--sdf-cache" && i + 1 < argc)
+            cache_cells = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--sdf-cache-band" && i + 1 < argc)
+            cache_band = std::max(0., atof(argv[++i]));
+        else if (std::string(argv[i]) == "--no-packets")
+            march.packets = false;
+        else if (std::string(argv[i]) == "--step-stats")
+            step_stats = true;
+        else if (std::string(argv[i]) == "--march-stats" && i + 1 < argc)
+            march_stats_prefix = argv[++i];
+        else if (std::string(argv[i]) == "--no-cull")
+            cull = false;
+        else if (std::string(argv[i]) == "--cull-stats")
+            cull_stats = true;
+        else if (std::string(argv[i]) == "--temporal")
+            temporal = true;
+        else if (std::string(argv[i]) == "--prepass" && i + 1 < argc && (atoi(argv[i + 1]) == 4 || atoi(argv[i + 1]) == 8))
+            prepass = atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--seed-distance" && i + 1 < argc)
+            march.seed_distance = std::max(0., atof(argv[++i]));
+        else if (std::string(argv[i]) == "--frame-parallel" && i + 1 < argc)
+            frame_groups = std::max(1, atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--scene" && i + 1 < argc)
+            scene_file = argv[++i];
+        else if (std::string(argv[i]) == "--no-prune")
+            prune = false;
+        else if (std::string(argv[i]) == "--output" && i + 1 < argc)
+            output = argv[++i];
+        else if (std::string(argv[i]) == "--jpeg-quality" && i + 1 < argc)
+            jpeg_quality = std::max(1, std::min(100, atoi(argv[++i])));
+        else if (std::string(argv[i]) == "--frames" && i + 1 < argc &&
+                 (sscanf(argv[i + 1], "%d-%d", &first_frame, &last_frame) == 2 || sscanf(argv[i + 1], "%d", &first_frame) == 1))
+        {
+            if (!strchr(argv[++i], '-'))
+                last_frame = first_frame;
+        }
+        else if (std::string(argv[i]) == "--shard" && i + 1 < argc && sscanf(argv[i + 1], "%d/%d", &shard, &shards) == 2 &&
+                 shards > 0 && shard >= 0 && shard < shards)
+            i++;
+        else if (std::string(argv[i]) == "--resume")
+            resume = true;
+        else if (std::string(argv[i]) == "--manifest" && i + 1 < argc)
+            manifest_file = argv[++i];
+        else if (std::string(argv[i]) == "--pipeline-stats")
+            pipeline_stats = true;
+        else if (std::string(argv[i]) == "--sched-stats")
+            sched_stats = true;
+        else if (std::string(argv[i]) == "--check-noise")
+            return check_noise(std::cout) ? 0 : 1;
+        else if (std::string(argv[i]) == "--bench-noise")
+        {
+            bench_noise(std::cout);
+            return 0;
+        }
+        else if (std::string(argv[i]) == "--bench-sdf")
+        {
+            bench_sdf(std::cout);
+            return 0;
+        }
+        else if (std::string(argv[i]) == "--bench-fast-math")
+        {
+            bench_fast_math(std::cout);
+            return 0;
+        }
+        else if (std::string(argv[i]) == "--image-diff" && i + 2 < argc) // e.g. the frames of a FAST_MATH build against the default's
+        {
+            FrameBuffer a(0, 0, PIXEL_RGB8), b(0, 0, PIXEL_RGB8);
+            for (int k = 1; k <= 2; k++)
+                if (!read_ppm_image(argv[i + k], k == 1 ? a : b))
+                {
+                    std::cerr << argv[i + k] << ": not a binary 8 bit PPM" << std::endl;
+                    return 1;
+                }
+            if (a.w != b.w || a.h != b.h)
+            {
+                std::cerr << "the images differ in size" << std::endl;
+                return 1;
+            }
+            report_image_error(a, b, std::string(argv[i + 1]) + " vs " + argv[i + 2], std::cout);
+            return 0;
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--format rgb32f|rgba16f|rgb8] [--alloc-stats]" << std::endl
+                      << "       [--stepper fixed|lipschitz] [--max-steps N] [--lipschitz L] [--relaxation W] [--no-packets] [--step-stats]" << std::endl
+                      << "       [--march-stats PREFIX]" << std::endl
+                      << "       [--octaves N] [--noise-lod BIAS] [--lod-stats] [--lod-error] [--volume [--volume-cells N]]" << std::endl
+                      << "       [--noise-grid CELLS [--noise-grid-budget MB] [--noise-grid-error]] [--frame-parallel K]" << std::endl
+                      << "       [--frames FIRST[-LAST]] [--shard I/N] [--resume] [--manifest FILE]" << std::endl
+                      << "       [--views N [--sdf-cache CELLS [--sdf-cache-band W]]]" << std::endl
+                      << "       [--output FILE.y4m|FILE.avi|- [--jpeg-quality Q]] [--pipeline-stats] [--sched-stats]" << std::endl
+                      << "       | --scene FILE [--no-prune]" << std::endl
+                      << "       | --check-noise | --bench-noise | --bench-sdf | --bench-fast-math" << std::endl
+                      << "       | --image-diff A.ppm B.ppm" << std::endl;
+            return 1;
+        }
+    }
+
     const int width = 640;
     const int height = 480;
     const float fov = M_PI / 3.;
@@ -117,49 +695,301 @@ int main()
     const int total_frames = frames_per_second * total_seconds;
     const float start_radius = 1;
     const float end_radius = 2.5;
+    if (!scene_file.empty()) // a single still of the scene
+    {
+        std::ifstream in(scene_file);
+        SdfNode root;
+        std::string error;
+        if (!in)
+            error = "cannot open the file";
+        if (!in || !parse_sdf_scene(in, root, error))
+        {
+            std::cerr << scene_file << ": " << error << std::endl;
+            return 1;
+        }
+        SdfProgram scene(root);
+        std::cout << scene_file << ": " << root.count() << " nodes, " << scene.size() << " instructions, "
+                  << scene.registers() << " registers, lipschitz " << scene.lipschitz() << std::endl;
+        FrameBuffer fb(width, height, format);
+        double empty_tiles = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double per_eval = render_scene(fb, fov, scene, prune, 20, march.max_steps, empty_tiles);
+        std::cout << "rendered in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                  << " s, " << per_eval << " instructions per packet evaluation, " << 100 * empty_tiles << "% of the tiles empty" << std::endl;
+        fb.drop_ppm_image("./out_scene.ppm");
+        return 0;
+    }
 
-    for (int frame = 0; frame < total_frames; frame++)
+    // The frames of this run: a range, every shards-th frame of it, without those an earlier run already finished.
+    // Shards interleave rather than split the range, the late frames with the big fireball cost the most.
+    first_frame = std::max(0, first_frame);
+    last_frame = last_frame < 0 ? total_frames - 1 : std::min(last_frame, total_frames - 1);
+    if (resume && !output.empty())
+    {
+        std::cerr << "--resume works on the PPM frames, not on --output" << std::endl;
+        return 1;
+    }
+    // Temporal seeding makes a frame's pixels depend on the frames its group rendered before it. A run that renders
+    // part of the animation, or keeps a manifest to be resumed, ignores --temporal and renders every frame on its own,
+    // so that any split of the work, resumed or not, writes the frames of a single default run byte for byte.
+    const bool partial = first_frame > 0 || last_frame < total_frames - 1 || shards > 1 || resume || !manifest_file.empty();
+    if (partial)
+        temporal = false;
+    std::unique_ptr<FrameManifest> manifest;
+    if (output.empty() && (resume || shards > 1 || !manifest_file.empty())) // one per shard, so that the shards of one directory never write the same file
     {
-        float t = (float)frame / (total_frames - 1);
-        sphere_radius = lerp(start_radius, end_radius, t); // Linear interpolation
+        if (manifest_file.empty())
+            manifest_file = shards > 1 ? "./manifest_" + std::to_string(shard) + "_of_" + std::to_string(shards) + ".txt" : "./manifest.txt";
+        manifest.reset(new FrameManifest(manifest_file, total_frames));
+        if (resume && !manifest->load())
+        {
+            std::cerr << manifest_file << ": malformed line" << std::endl;
+            return 1;
+        }
+        if (!manifest->open())
+        {
+            std::cerr << manifest_file << ": cannot open the file" << std::endl;
+            return 1;
+        }
+    }
+    std::vector<uint8_t> todo(total_frames, false);
+    int selected = 0, finished = 0;
+    for (int frame = first_frame; frame <= last_frame; frame++)
+        if (frame % shards == shard)
+        {
+            selected++;
+            bool done = resume && manifest->done(frame);
+            todo[frame] = !done;
+            finished += done;
+        }
+
+    std::unique_ptr<FrameSink> sink(new PpmWriter("./out_", manifest.get()));
+    if (!output.empty())
+    {
+        const bool avi = output.size() > 4 && output.compare(output.size() - 4, 4, ".avi") == 0;
+        const bool y4m = output == "-" || (output.size() > 4 && output.compare(output.size() - 4, 4, ".y4m") == 0);
+        bool ok = false;
+        if (avi)
+        {
+            MjpegAviWriter *writer = new MjpegAviWriter(output, width, height, frames_per_second, jpeg_quality);
+            sink.reset(writer);
+            ok = writer->ok();
+        }
+        else if (y4m)
+        {
+            Y4mWriter *writer = new Y4mWriter(output, width, height, frames_per_second);
+            sink.reset(writer);
+            ok = writer->ok();
+        }
+        if (!ok)
+        {
+            std::cerr << output << (avi || y4m ? ": cannot open the file" : ": the output must end in .y4m or .avi, or be -") << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &log = output == "-" ? std::cerr : std::cout; // keep standard output for the video
+    if (selected < total_frames || finished)
+        log << "rendering " << selected - finished << " of " << total_frames << " frames (frames " << first_frame << "-" << last_frame
+            << ", shard " << shard << "/" << shards << "), " << finished << " already done" << std::endl;
 
-        std::vector<Vec3f> framebuffer(width * height);
+    RenderContext base; // what every frame shares, each frame sets its own radius
+    base.march = march;
+    base.octaves = octaves, base.noise_lod = noise_lod;
+    std::unique_ptr<NoiseGrid> grid;
+    if (grid_cells)
+    {
+        // the marcher never leaves the ball around the camera's distance (3) plus the normal's eps
+        const float extent = (3.f + 0.1f) * 3.4f;
+        grid.reset(new NoiseGrid(Vec3f(-extent, -extent, -extent), Vec3f(extent, extent, extent), grid_cells, grid_budget_mb << 20));
+        grid->report(log);
+        if (grid_error) // halfway through the animation, when the fireball covers most of the frame
+        {
+            FrameBuffer analytic(width, height, format), gridded(width, height, format);
+            RenderContext ctx = base;
+            ctx.sphere_radius = lerp(start_radius, end_radius, .5f);
+            render_frame(ctx, analytic, fov);
+            ctx.noise_grid = grid.get();
+            render_frame(ctx, gridded, fov);
+            report_image_error(gridded, analytic, "noise grid vs analytic noise, middle frame", log);
+        }
+        base.noise_grid = grid.get();
+    }
+    if (noise_lod > 0)
+        base.pixel_angle = fov / height;
+    if (lod_error) // the middle frame again, with every octave in full
+    {
+        FrameBuffer full(width, height, format), reduced(width, height, format);
+        OctaveCounter counter;
+        RenderContext ctx = base;
+        ctx.sphere_radius = lerp(start_radius, end_radius, .5f);
+        ctx.octave_counter = &counter;
+        render_frame(ctx, reduced, fov);
+        OctaveCounts counts = counter.take();
+        RenderContext reference = ctx;
+        reference.octaves = FBM_OCTAVES, reference.noise_lod = 0, reference.pixel_angle = 0, reference.octave_counter = nullptr;
+        render_frame(reference, full, fov);
+        report_image_error(reduced, full, "noise LOD vs every octave, middle frame", log);
+        log << "noise LOD, middle frame: " << (double)counts.octaves / std::max<uint64_t>(1, counts.calls) << " octaves per signed distance, "
+            << counts.calls << " evaluations" << std::endl;
+    }
+    std::unique_ptr<OccupancyGrid> occupancy;
+    if (volume_cells)
+    {
+        // the fire never leaves the sphere of the final radius
+        occupancy.reset(new OccupancyGrid(end_radius, volume_cells, march.lipschitz));
+        occupancy->report({start_radius, lerp(start_radius, end_radius, .5f), end_radius}, log);
+        base.volume = occupancy.get();
+    }
 
-#pragma omp parallel for
-        for (size_t j = 0; j < height; j++)
+    if (views) // the middle frame from cameras evenly spaced around it, the fireball turns in front of the camera
+    {
+        RenderContext ctx = base;
+        ctx.sphere_radius = lerp(start_radius, end_radius, .5f);
+        std::unique_ptr<SdfCache> cache;
+        if (cache_cells && (ctx.noise_grid || ctx.pixel_angle > 0 || ctx.octaves < FBM_OCTAVES))
         {
-            for (size_t i = 0; i < width; i++)
-            {
-                float dir_x = (i + 0.5) - width / 2.;
-                float dir_y = -(j + 0.5) + height / 2.;
-                float dir_z = -height / (2. * tan(fov / 2.));
-                Vec3f hit;
-                if (sphere_trace(Vec3f(0, 0, 3), Vec3f(dir_x, dir_y, dir_z).normalize(), hit))
-                {
-                    float noise_level = (sphere_radius - hit.norm()) / noise_amplitude;
-                    Vec3f light_dir = (Vec3f(10, 10, 10) - hit).normalize();
-                    float light_intensity = std::max(0.4f, light_dir * distance_field_normal(hit));
-                    framebuffer[i + j * width] = fire_color((-.2 + noise_level) * 2) * light_intensity;
-                }
-                else
-                {
-                    framebuffer[i + j * width] = Vec3f(0.2, 0.7, 0.8); // background color
-                }
-            }
+            std::cerr << "--sdf-cache holds the field of the full analytic noise, it does not go with --noise-grid, --noise-lod or --octaves" << std::endl;
+            return 1;
         }
+        if (cache_cells) // the marcher stays within the bounding sphere, the normals up to their eps beyond it
+        {
+            cache.reset(new SdfCache(ctx.sphere_radius, ctx.sphere_radius + .2f, cache_cells, cache_band, march.lipschitz));
+            ctx.sdf_cache = cache.get();
+        }
+        FrameBuffer fb(width, height, format);
+        double total = 0;
+        for (int v = 0; v < views; v++)
+        {
+            ctx.turn_cos = std::cos(2 * M_PI * v / views), ctx.turn_sin = std::sin(2 * M_PI * v / views);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            render_frame(ctx, fb, fov, nullptr, cull, nullptr, prepass);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            total += seconds;
+            log << "view " << v << ": " << seconds << " s" << std::endl;
+            fb.drop_ppm_image("./view_" + std::to_string(v) + ".ppm");
+        }
+        log << views << " views in " << total << " s" << std::endl;
+        if (cache)
+        {
+            cache->report(log);
+            FrameBuffer analytic(width, height, format);
+            ctx.sdf_cache = nullptr;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            render_frame(ctx, analytic, fov, nullptr, cull, nullptr, prepass);
+            log << "last view without the cache: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+            report_image_error(fb, analytic, "sdf cache vs analytic, last view", log);
+        }
+        return 0;
+    }
 
-        std::ofstream ofs("./out_" + std::to_string(frame) + ".ppm", std::ios::binary);
-        ofs << "P6\n"
-            << width << " " << height << "\n255\n";
-        for (size_t i = 0; i < height * width; ++i)
+    // The frames are dealt out in turn to frame_groups groups of threads, each with its own history,
+    // and the rows of a frame go to the threads of its group. Several small frames at once keep more cores busy than
+    // the rows of one; a group's consecutive frames are frame_groups frames apart, which temporal seeding tolerates
+    // as long as the radius moves less than march.seed_distance / 2 in between.
+    std::unique_ptr<MarchStatsWriter> march_stats;
+    if (alloc_stats && !ALLOC_STATS)
+    {
+        std::cerr << "--alloc-stats needs a build that counts the allocations (cmake -DALLOC_STATS=ON)" << std::endl;
+        return 1;
+    }
+    if (!march_stats_prefix.empty())
+    {
+        if (!MARCH_STATS)
+        {
+            std::cerr << "--march-stats needs a build with the instrumentation (cmake -DMARCH_STATS=ON)" << std::endl;
+            return 1;
+        }
+        march_stats.reset(new MarchStatsWriter(march_stats_prefix, march.max_steps));
+        if (!march_stats->ok())
         {
-            for (size_t j = 0; j < 3; j++)
+            std::cerr << march_stats_prefix << ".csv, .json: cannot open the files" << std::endl;
+            return 1;
+        }
+    }
+    const int normals_per_hit = base.volume ? 0 : 4; // signed_distance calls, for the stats
+    const int groups = std::max(1, std::min(frame_groups, total_frames));
+    // The frames are written on a thread of their own, in order. Each group renders into a slot of the encoder's
+    // ring; one slot per group plus one lets every group start its next frame while the one before is being written.
+    FrameEncoder encoder(*sink, groups + 1, width, height, format);
+    double render_seconds = 0;
+    int rendered = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#ifdef _OPENMP
+    const int threads_per_group = std::max(1, omp_get_max_threads() / groups);
+    if (groups > 1)
+        omp_set_max_active_levels(2);
+#endif
+#pragma omp parallel num_threads(groups)
+    {
+#ifdef _OPENMP
+        const int group = omp_get_thread_num();
+        omp_set_num_threads(threads_per_group); // for the parallel regions of this group's frames
+#else
+        const int group = 0;
+#endif
+        std::vector<int> steps(step_stats || march_stats ? width * height : 0);
+        std::vector<MarchEnd> ends(march_stats ? width * height : 0);
+        DepthHistory history; // seeds each frame's rays with the hits of the group's frame before
+        TileScheduler scheduler;
+        OctaveCounter counter; // the group renders one frame at a time, so it counts that frame's octaves
+        RenderContext ctx = base;
+        if (lod_stats)
+            ctx.octave_counter = &counter;
+        int dealt = 0;
+        for (int frame = 0; frame < total_frames; frame++)
+        {
+            if (!todo[frame] || dealt++ % groups != group)
+                continue;
+            float t = (float)frame / (total_frames - 1);
+            ctx.sphere_radius = lerp(start_radius, end_radius, t); // Linear interpolation
+
+            FrameBuffer &fb = encoder.acquire(dealt - 1);
+            std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+            size_t heap_before = heap_allocations(); // process-wide, other groups' frames and the encoder thread count too
+            double skipped = render_frame(ctx, fb, fov, steps.empty() ? nullptr : steps.data(), cull, temporal ? &history : nullptr, prepass, &scheduler,
+                                          ends.empty() ? nullptr : ends.data());
+            size_t heap_after = heap_allocations();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+            if (manifest)
+                manifest->set_render_seconds(frame, seconds);
+            encoder.release(dealt - 1, frame);
+            if (march_stats) // before report_steps() reorders the steps
+                march_stats->record(frame, steps, ends, width, height, normals_per_hit, seconds);
+
+#pragma omp critical(report)
             {
-                ofs << (char)(std::max(0, std::min(255, static_cast<int>(255 * framebuffer[i][j]))));
+                if (step_stats)
+                    report_steps(steps, frame, log);
+                if (cull_stats)
+                    log << "frame " << frame << ": " << 100 * skipped << "% of the pixels skipped by tile culling and the prepass" << std::endl;
+                render_seconds += seconds;
+                rendered++;
+                if (sched_stats)
+                    report_busy(scheduler, frame, log);
+                if (lod_stats)
+                {
+                    OctaveCounts counts = counter.take();
+                    log << "frame " << frame << ": " << (double)counts.octaves / std::max<uint64_t>(1, counts.calls) << " octaves per signed distance" << std::endl;
+                }
+                if (alloc_stats) // rendering only, writing the file is not part of the steady state
+                    log << "frame " << frame << ": " << heap_after - heap_before << " heap allocations" << std::endl;
             }
         }
-        ofs.close();
     }
 
+    if (!encoder.finish())
+    {
+        std::cerr << (output.empty() ? "./out_*.ppm" : output) << ": write error" << std::endl;
+        return 1;
+    }
+    if (pipeline_stats)
+    {
+        // without the pipeline the groups' rendering and the writing would have taken turns
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double serial = render_seconds / groups + encoder.busy();
+        log << rendered << " frames in " << wall << " s, " << rendered / wall << " frames/s; rendering " << render_seconds / groups
+            << " s, writing " << encoder.busy() << " s, " << 100 * std::max(0., std::min(1., (serial - wall) / encoder.busy()))
+            << "% of the writing overlapped with rendering, " << encoder.stalled() << " s waiting for a free slot" << std::endl;
+    }
     return 0;
 }
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <new>
+#include "scheduler.h"
+
+void TileScheduler::start(const size_t threads)
+{
+    const size_t tiles = costs_.size();
+    if (threads != threads_)
+    {
+        size_t space = threads * sizeof(Queue) + alignof(Queue) - 1;
+        queue_buffer_.reset(new char[space]);
+        void *queues = queue_buffer_.get();
+        queues_ = static_cast<Queue *>(std::align(alignof(Queue), threads * sizeof(Queue), queues, space));
+        for (size_t k = 0; k < threads; k++)
+            new (&queues_[k]) Queue;
+        threads_ = threads;
+        clear_busy();
+    }
+    sorted_.resize(tiles);
+    for (size_t t = 0; t < tiles; t++)
+        sorted_[t] = t;
+    std::sort(sorted_.begin(), sorted_.end(), [&](const uint32_t a, const uint32_t b) {
+        return costs_[a] > costs_[b] || (costs_[a] == costs_[b] && a < b);
+    });
+    order_.resize(tiles);
+    for (size_t k = 0, first = 0; k < threads; k++)
+    {
+        size_t end = first;
+        for (size_t t = k; t < tiles; t += threads)
+            order_[end++] = sorted_[t];
+        queues_[k].ends.store((uint64_t)first << 32 | end, std::memory_order_relaxed);
+        first = end;
+    }
+    // the region's barrier publishes the queues to the other threads
+}
+
+bool TileScheduler::next(const size_t thread, size_t &tile)
+{
+    for (size_t k = 0; k < threads_; k++)
+    {
+        const bool own = k == 0;
+        std::atomic<uint64_t> &ends = queues_[(thread + k) % threads_].ends;
+        uint64_t e = ends.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint32_t first = e >> 32, end = (uint32_t)e;
+            if (first == end)
+                break;
+            uint64_t taken = own ? (uint64_t)(first + 1) << 32 | end : (uint64_t)first << 32 | (end - 1);
+            if (ends.compare_exchange_weak(e, taken, std::memory_order_relaxed))
+            {
+                tile = order_[own ? first : end - 1];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<double> TileScheduler::busy() const
+{
+    std::vector<double> seconds(threads_);
+    for (size_t k = 0; k < threads_; k++)
+        seconds[k] = queues_[k].busy;
+    return seconds;
+}
+
+void TileScheduler::clear_busy()
+{
+    for (size_t k = 0; k < threads_; k++)
+        queues_[k].busy = 0;
+}
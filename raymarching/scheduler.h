@@ -0,0 +1,43 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Hands out the tiles of a frame to the threads of a parallel region. The tiles are sorted by estimated cost, most
+// expensive first, and dealt round robin into one queue per thread, so every thread starts on its share of the
+// expensive ones. A thread takes the front of its own queue; once that is empty it steals from the back of the
+// others', where the cheap tiles are, so the last few milliseconds are evened out with small pieces of work.
+// A queue is a slice of the sorted order whose two ends move with a single compare-and-swap: no locks.
+class TileScheduler
+{
+public:
+    TileScheduler() : queues_(nullptr), threads_(0) {}
+    TileScheduler(const TileScheduler &) = delete;
+    TileScheduler &operator=(const TileScheduler &) = delete;
+
+    std::vector<float> &costs() { return costs_; } // filled in by the caller, one per tile, before start()
+    void start(const size_t threads);              // deals the tiles; by one thread, before any calls to next()
+    bool next(const size_t thread, size_t &tile);  // false once every queue is empty
+
+    // seconds each thread spent working on tiles, summed over the frames since the last clear_busy()
+    void add_busy(const size_t thread, const double seconds) { queues_[thread].busy += seconds; }
+    std::vector<double> busy() const;
+    void clear_busy();
+
+private:
+    struct alignas(64) Queue // a cache line of its own, each thread hammers on its own
+    {
+        std::atomic<uint64_t> ends; // first << 32 | end, positions in order_
+        double busy;
+    };
+    std::vector<float> costs_;
+    std::vector<uint32_t> sorted_; // the tiles by decreasing cost
+    std::vector<uint32_t> order_;  // queue k holds the tiles order_[ends.first, ends.end)
+    std::unique_ptr<char[]> queue_buffer_; // new ignores alignas before C++17: queues_ is aligned within this
+    Queue *queues_;
+    size_t threads_;
+};
+
+#endif //__SCHEDULER_H__
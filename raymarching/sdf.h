@@ -0,0 +1,165 @@
+#ifndef __SDF_H__
+#define __SDF_H__
+#include <algorithm>
+#include <cmath>
+#include "geometry.h"
+#include "noise.h"
+
+// Signed distance functions that compose at compile time. Every node is a small value type with
+// float operator()(const Vec3f &p); combinators hold their children by value, so a whole scene is one type and the
+// compiler inlines it into a single function, no virtual calls, no heap. Scenes are built with the helper functions:
+//   auto scene = smooth_union(translate(sdf_sphere(1), Vec3f(0, 1, 0)), sdf_floor(0), .3f);
+//   float d = scene(p);
+// Distances are exact for the primitives and bounds (not exact) after intersections, smooth unions and displacement.
+
+template <typename Derived>
+struct Sdf // tag base, only nodes take part in the operators below
+{
+};
+
+struct SdfSphere : Sdf<SdfSphere>
+{
+    float radius;
+    explicit SdfSphere(const float radius) : radius(radius) {}
+    float operator()(const Vec3f &p) const { return p.norm() - radius; }
+};
+
+struct SdfBox : Sdf<SdfBox>
+{
+    Vec3f half; // half extents, centered at the origin
+    explicit SdfBox(const Vec3f &half) : half(half) {}
+    float operator()(const Vec3f &p) const
+    {
+        Vec3f q(std::abs(p.x) - half.x, std::abs(p.y) - half.y, std::abs(p.z) - half.z);
+        Vec3f outside(std::max(q.x, 0.f), std::max(q.y, 0.f), std::max(q.z, 0.f));
+        return outside.norm() + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
+    }
+};
+
+struct SdfTorus : Sdf<SdfTorus>
+{
+    float major, minor; // in the xz plane around the y axis
+    SdfTorus(const float major, const float minor) : major(major), minor(minor) {}
+    float operator()(const Vec3f &p) const
+    {
+        float ring = std::sqrt(p.x * p.x + p.z * p.z) - major;
+        return std::sqrt(ring * ring + p.y * p.y) - minor;
+    }
+};
+
+struct SdfPlane : Sdf<SdfPlane>
+{
+    Vec3f normal; // unit length
+    float offset; // points with p . normal = offset are on the plane
+    SdfPlane(const Vec3f &normal, const float offset) : normal(normal), offset(offset) {}
+    float operator()(const Vec3f &p) const { return p * normal - offset; }
+};
+
+struct SdfFloor : Sdf<SdfFloor> // the plane with normal +y; a general SdfPlane would pay two products with 0 per point
+{
+    float height;
+    explicit SdfFloor(const float height) : height(height) {}
+    float operator()(const Vec3f &p) const { return p.y - height; }
+};
+
+template <typename E>
+struct SdfTranslate : Sdf<SdfTranslate<E>>
+{
+    E e;
+    Vec3f offset;
+    SdfTranslate(const E &e, const Vec3f &offset) : e(e), offset(offset) {}
+    float operator()(const Vec3f &p) const { return e(p - offset); }
+};
+
+template <typename E>
+struct SdfScale : Sdf<SdfScale<E>>
+{
+    E e;
+    float factor; // uniform, so the distance scales along
+    SdfScale(const E &e, const float factor) : e(e), factor(factor) {}
+    float operator()(const Vec3f &p) const { return e(p * (1.f / factor)) * factor; }
+};
+
+template <typename E>
+struct SdfRotate : Sdf<SdfRotate<E>>
+{
+    E e;
+    Vec3f rows[3]; // orthonormal, world to object
+    SdfRotate(const E &e, const Vec3f &r0, const Vec3f &r1, const Vec3f &r2) : e(e), rows{r0, r1, r2} {}
+    float operator()(const Vec3f &p) const { return e(Vec3f(rows[0] * p, rows[1] * p, rows[2] * p)); }
+};
+
+template <typename E>
+struct SdfRotateY : Sdf<SdfRotateY<E>> // SdfRotate about the y axis in 4 products instead of 9, y passes through
+{
+    E e;
+    float c, s; // cosine and sine of the angle
+    SdfRotateY(const E &e, const float c, const float s) : e(e), c(c), s(s) {}
+    float operator()(const Vec3f &p) const { return e(Vec3f(c * p.x - s * p.z, p.y, s * p.x + c * p.z)); }
+};
+
+template <typename A, typename B>
+struct SdfUnion : Sdf<SdfUnion<A, B>>
+{
+    A a;
+    B b;
+    SdfUnion(const A &a, const B &b) : a(a), b(b) {}
+    float operator()(const Vec3f &p) const { return std::min(a(p), b(p)); }
+};
+
+template <typename A, typename B>
+struct SdfIntersection : Sdf<SdfIntersection<A, B>>
+{
+    A a;
+    B b;
+    SdfIntersection(const A &a, const B &b) : a(a), b(b) {}
+    float operator()(const Vec3f &p) const { return std::max(a(p), b(p)); }
+};
+
+template <typename A, typename B>
+struct SdfSmoothUnion : Sdf<SdfSmoothUnion<A, B>>
+{
+    A a;
+    B b;
+    float k; // blend radius
+    SdfSmoothUnion(const A &a, const B &b, const float k) : a(a), b(b), k(k) {}
+    float operator()(const Vec3f &p) const // polynomial smooth minimum
+    {
+        float da = a(p), db = b(p);
+        float h = std::max(k - std::abs(da - db), 0.f) / k;
+        return std::min(da, db) - h * h * k * .25f;
+    }
+};
+
+// base pushed inwards by amplitude * fractal_brownian_motion(p * frequency), the fireball's displacement
+template <typename E>
+struct SdfDisplace : Sdf<SdfDisplace<E>>
+{
+    E e;
+    float amplitude, frequency;
+    SdfDisplace(const E &e, const float amplitude, const float frequency) : e(e), amplitude(amplitude), frequency(frequency) {}
+    float operator()(const Vec3f &p) const { return e(p) + fractal_brownian_motion(p * frequency) * amplitude; }
+};
+
+inline SdfSphere sdf_sphere(const float radius) { return SdfSphere(radius); }
+inline SdfBox sdf_box(const Vec3f &half) { return SdfBox(half); }
+inline SdfTorus sdf_torus(const float major, const float minor) { return SdfTorus(major, minor); }
+inline SdfPlane sdf_plane(const Vec3f &normal, const float offset) { return SdfPlane(normal, offset); }
+inline SdfFloor sdf_floor(const float height) { return SdfFloor(height); }
+
+template <typename E>
+SdfTranslate<E> translate(const Sdf<E> &e, const Vec3f &offset) { return SdfTranslate<E>(static_cast<const E &>(e), offset); }
+template <typename E>
+SdfScale<E> scale(const Sdf<E> &e, const float factor) { return SdfScale<E>(static_cast<const E &>(e), factor); }
+template <typename E> // by angle radians around the y axis
+SdfRotateY<E> rotate_y(const Sdf<E> &e, const float angle) { return SdfRotateY<E>(static_cast<const E &>(e), std::cos(angle), std::sin(angle)); }
+template <typename A, typename B>
+SdfUnion<A, B> operator|(const Sdf<A> &a, const Sdf<B> &b) { return SdfUnion<A, B>(static_cast<const A &>(a), static_cast<const B &>(b)); }
+template <typename A, typename B>
+SdfIntersection<A, B> operator&(const Sdf<A> &a, const Sdf<B> &b) { return SdfIntersection<A, B>(static_cast<const A &>(a), static_cast<const B &>(b)); }
+template <typename A, typename B>
+SdfSmoothUnion<A, B> smooth_union(const Sdf<A> &a, const Sdf<B> &b, const float k) { return SdfSmoothUnion<A, B>(static_cast<const A &>(a), static_cast<const B &>(b), k); }
+template <typename E>
+SdfDisplace<E> displace(const Sdf<E> &e, const float amplitude, const float frequency) { return SdfDisplace<E>(static_cast<const E &>(e), amplitude, frequency); }
+
+#endif //__SDF_H__
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "noise.h"
+#include "march.h"
+#include "sdf_cache.h"
+
+namespace
+{
+const int BRICK_SAMPLES = SdfCache::BRICK * SdfCache::BRICK * SdfCache::BRICK;
+float far_brick[BRICK_SAMPLES]; // the slot of a brick away from the surface points here; distance8 reads zeros from it for lanes without samples
+} // namespace
+
+SdfCache::SdfCache(const float radius, const float extent, const int cells, const float band, const float lipschitz)
+    : radius_(radius), band_(band), lo_(-extent), cell_(0), inv_cell_(0), margin_(0), bricks_(std::max(1, (cells + BRICK - 2) / (BRICK - 1))),
+      slots_(new std::atomic<float *>[(size_t)bricks_ * bricks_ * bricks_]), built_(0), kept_(0)
+{
+    cell_ = 2 * extent / resolution();
+    inv_cell_ = 1 / cell_;
+    margin_ = lipschitz * cell_ * std::sqrt(3.f) / 2; // a point's mean distance to the corners, by their weights
+    for (size_t s = 0; s < (size_t)bricks_ * bricks_ * bricks_; s++)
+        slots_[s].store(nullptr, std::memory_order_relaxed);
+}
+
+SdfCache::~SdfCache()
+{
+    for (size_t s = 0; s < (size_t)bricks_ * bricks_ * bricks_; s++)
+    {
+        float *samples = slots_[s].load(std::memory_order_relaxed);
+        if (samples != far_brick)
+            delete[] samples;
+    }
+}
+
+const float *SdfCache::brick(const int bx, const int by, const int bz) const
+{
+    std::atomic<float *> &slot = slots_[((size_t)bz * bricks_ + by) * bricks_ + bx];
+    float *samples = slot.load(std::memory_order_acquire);
+    if (samples)
+        return samples;
+
+    // build it: rows of BRICK samples, one call of the 8-wide kernel each
+    static_assert(BRICK == NOISE_LANES, "a brick row is built with one call of the 8-wide kernel");
+    std::unique_ptr<float[]> built(new float[BRICK_SAMPLES]);
+    float x[BRICK], y[BRICK], z[BRICK], r[BRICK], fbm[BRICK];
+    bool near = false;
+    for (int sz = 0; sz < BRICK; sz++)
+    {
+        for (int sy = 0; sy < BRICK; sy++)
+        {
+            for (int k = 0; k < BRICK; k++)
+            {
+                Vec3f p(lo_ + (bx * (BRICK - 1) + k) * cell_, lo_ + (by * (BRICK - 1) + sy) * cell_, lo_ + (bz * (BRICK - 1) + sz) * cell_);
+                r[k] = p.norm();
+                x[k] = p.x * 3.4f, y[k] = p.y * 3.4f, z[k] = p.z * 3.4f;
+            }
+            fractal_brownian_motion8(x, y, z, fbm);
+            float *row = &built[(sz * BRICK + sy) * BRICK];
+            for (int k = 0; k < BRICK; k++)
+            {
+                row[k] = r[k] - (radius_ - fbm[k] * noise_amplitude); // as signed_distance computes it
+                near = near || std::abs(row[k]) <= 2 * margin_ + band_;
+            }
+        }
+    }
+    float *expected = nullptr, *published = near ? built.get() : far_brick;
+    if (!slot.compare_exchange_strong(expected, published, std::memory_order_acq_rel, std::memory_order_acquire))
+        return expected; // another thread got there first, this copy goes
+    built_.fetch_add(1, std::memory_order_relaxed);
+    if (!near)
+        return published;
+    kept_.fetch_add(1, std::memory_order_relaxed);
+    return built.release();
+}
+
+bool SdfCache::distance(const Vec3f &p, float &d) const
+{
+    float u = (p.x - lo_) * inv_cell_, v = (p.y - lo_) * inv_cell_, w = (p.z - lo_) * inv_cell_;
+    const int n = resolution();
+    if (!(u >= 0 && v >= 0 && w >= 0 && u < n && v < n && w < n)) // also catches NaN
+        return false;
+    int i = u, j = v, k = w;
+    const int c = BRICK - 1;
+    const float *samples = brick(i / c, j / c, k / c);
+    if (samples == far_brick)
+        return false;
+    float fx = u - i, fy = v - j, fz = w - k;
+    const float *s = samples + ((k % c) * BRICK + j % c) * BRICK + i % c;
+    const int dy = BRICK, dz = BRICK * BRICK;
+    float c00 = s[0] + (s[1] - s[0]) * fx;
+    float c10 = s[dy] + (s[dy + 1] - s[dy]) * fx;
+    float c01 = s[dz] + (s[dz + 1] - s[dz]) * fx;
+    float c11 = s[dz + dy] + (s[dz + dy + 1] - s[dz + dy]) * fx;
+    float c0 = c00 + (c10 - c00) * fy;
+    float c1 = c01 + (c11 - c01) * fy;
+    d = c0 + (c1 - c0) * fz;
+    if (std::abs(d) <= 2 * margin_) // near the surface, where the hits and the normals are decided
+        return false;
+    d = d > 0 ? d - margin_ : d + margin_;
+    return true;
+}
+
+void SdfCache::distance8(const float *x, const float *y, const float *z, const uint8_t *want, float *d, uint8_t *ok) const
+{
+#if defined(__AVX2__)
+    // distance() lane by lane in the same operations. The brick lookups and the corner loads are scalar code: the
+    // gather instructions are microcoded on some processors and slower than eight plain loads per lane.
+    const __m256 lo = _mm256_set1_ps(lo_), inv_cell = _mm256_set1_ps(inv_cell_), zero = _mm256_setzero_ps();
+    const __m256 n = _mm256_set1_ps((float)resolution());
+    __m256 u = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x), lo), inv_cell);
+    __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(y), lo), inv_cell);
+    __m256 w = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(z), lo), inv_cell);
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, n, _CMP_LT_OQ)),
+                                  _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, n, _CMP_LT_OQ)));
+    inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GE_OQ), _mm256_cmp_ps(w, n, _CMP_LT_OQ)));
+    u = _mm256_and_ps(u, inside), v = _mm256_and_ps(v, inside), w = _mm256_and_ps(w, inside); // in range for the conversions
+    const __m256i i = _mm256_cvttps_epi32(u), j = _mm256_cvttps_epi32(v), k = _mm256_cvttps_epi32(w);
+    alignas(32) int32_t ii[8], jj[8], kk[8];
+    alignas(32) float corners[8][8]; // corner by lane
+    _mm256_store_si256((__m256i *)ii, i), _mm256_store_si256((__m256i *)jj, j), _mm256_store_si256((__m256i *)kk, k);
+    const int lanes_inside = _mm256_movemask_ps(inside), c = BRICK - 1, dy = BRICK, dz = BRICK * BRICK;
+    for (int l = 0; l < 8; l++)
+    {
+        const float *s = far_brick;
+        if (want[l] && (lanes_inside >> l & 1))
+            s = brick(ii[l] / c, jj[l] / c, kk[l] / c);
+        ok[l] = s != far_brick;
+        if (ok[l])
+            s += ((kk[l] % c) * BRICK + jj[l] % c) * BRICK + ii[l] % c;
+        corners[0][l] = s[0], corners[1][l] = s[1], corners[2][l] = s[dy], corners[3][l] = s[dy + 1];
+        corners[4][l] = s[dz], corners[5][l] = s[dz + 1], corners[6][l] = s[dz + dy], corners[7][l] = s[dz + dy + 1];
+    }
+    auto corner = [&](const int at) { return _mm256_load_ps(corners[at]); };
+    const __m256 fx = _mm256_sub_ps(u, _mm256_cvtepi32_ps(i)), fy = _mm256_sub_ps(v, _mm256_cvtepi32_ps(j)), fz = _mm256_sub_ps(w, _mm256_cvtepi32_ps(k));
+    auto lerp = [](const __m256 a, const __m256 b, const __m256 f) { return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), f)); };
+    __m256 c00 = lerp(corner(0), corner(1), fx), c10 = lerp(corner(2), corner(3), fx);
+    __m256 c01 = lerp(corner(4), corner(5), fx), c11 = lerp(corner(6), corner(7), fx);
+    __m256 r = lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+    const __m256 margin = _mm256_set1_ps(margin_), shell = _mm256_set1_ps(2 * margin_);
+    const __m256 away = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.f), r), shell, _CMP_GT_OQ);
+    r = _mm256_blendv_ps(_mm256_add_ps(r, margin), _mm256_sub_ps(r, margin), _mm256_cmp_ps(r, zero, _CMP_GT_OQ));
+    _mm256_storeu_ps(d, r);
+    const int lanes_away = _mm256_movemask_ps(away);
+    for (int l = 0; l < 8; l++)
+        ok[l] = ok[l] && (lanes_away >> l & 1);
+#else
+    for (int l = 0; l < 8; l++)
+        ok[l] = want[l] && distance(Vec3f(x[l], y[l], z[l]), d[l]);
+#endif
+}
+
+void SdfCache::report(std::ostream &out) const
+{
+    const size_t slots = (size_t)bricks_ * bricks_ * bricks_;
+    out << "sdf cache: " << resolution() << "^3 cells, band " << band_ << ", exact within " << 2 * margin_ << "; " << built_.load() << " of " << slots << " bricks built, "
+        << kept_.load() << " kept (" << kept_.load() * BRICK_SAMPLES * sizeof(float) / (1024. * 1024.) << " MB, dense: "
+        << slots * BRICK_SAMPLES * sizeof(float) / (1024. * 1024.) << " MB)" << std::endl;
+}
@@ -0,0 +1,51 @@
+#ifndef __SDF_CACHE_H__
+#define __SDF_CACHE_H__
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include "geometry.h"
+
+// signed_distance of one fireball (one radius, analytic noise) cached in a sparse grid of bricks around the surface,
+// for rendering it from several cameras: the views share the bricks, each pays only for those it touches first.
+// Bricks are built lazily by the thread that first looks into them, 8^3 samples of which neighbours share the border
+// ones like NoiseGrid's, and published with a compare-and-swap; a brick none of whose samples lies within band beyond
+// the exact shell (below) keeps no samples, so the memory grows with the area of the surface, not with the volume.
+// Lookups interpolate trilinearly and only skip empty space: within a cell the interpolant is off by at most
+// lipschitz times half a cell diagonal (the margin), so a lookup answers with the interpolant moved that much towards
+// the surface, a distance that is never too long and has the true sign, and leaves the points within two margins of
+// the surface (a cell diagonal of sphere-tracing steps) to the caller's exact field, as it does those outside the
+// band and outside the grid. A march on the cache therefore decides its hits on the exact field; its samples on the
+// way there, and thus its steps and the hit point within the march's eps, differ from the analytic march's.
+class SdfCache
+{
+public:
+    static const int BRICK = 8; // samples per brick edge
+
+    // the cube [-extent, extent]^3 at a resolution of cells per axis, rounded up to whole bricks
+    // lipschitz: the bound on the field's gradient the marcher steps by
+    SdfCache(const float radius, const float extent, const int cells, const float band, const float lipschitz);
+    ~SdfCache();
+    SdfCache(const SdfCache &) = delete;
+    SdfCache &operator=(const SdfCache &) = delete;
+
+    float radius() const { return radius_; }
+    bool distance(const Vec3f &p, float &d) const; // false: p is near the surface or not in a cached brick
+    // distance() for 8 points in structure-of-arrays form, the same values bit for bit; lanes without want are skipped
+    void distance8(const float *x, const float *y, const float *z, const uint8_t *want, float *d, uint8_t *ok) const;
+    float margin() const { return margin_; }
+    int resolution() const { return bricks_ * (BRICK - 1); } // cells per axis
+
+    // bricks built, kept and their memory
+    void report(std::ostream &out) const;
+
+private:
+    float radius_, band_, lo_, cell_, inv_cell_, margin_;
+    int bricks_; // per axis
+    std::unique_ptr<std::atomic<float *>[]> slots_; // null: not built yet
+    mutable std::atomic<size_t> built_, kept_;
+
+    const float *brick(const int bx, const int by, const int bz) const;
+};
+
+#endif //__SDF_CACHE_H__
@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+#include "sdf_program.h"
+
+size_t SdfNode::count() const
+{
+    size_t n = 1;
+    for (const SdfNode &c : children)
+        n += c.count();
+    return n;
+}
+
+// ---------------------------------------------------------------- parsing
+
+namespace
+{
+struct NodeSyntax
+{
+    const char *name;
+    SdfNode::Kind kind;
+    size_t params;
+    size_t min_children, max_children;
+};
+
+const NodeSyntax syntax[] = {
+    {"sphere", SdfNode::SPHERE, 1, 0, 0},
+    {"box", SdfNode::BOX, 3, 0, 0},
+    {"torus", SdfNode::TORUS, 2, 0, 0},
+    {"plane", SdfNode::PLANE, 4, 0, 0},
+    {"translate", SdfNode::TRANSLATE, 3, 1, 1},
+    {"scale", SdfNode::SCALE, 1, 1, 1},
+    {"rotate_y", SdfNode::ROTATE_Y, 1, 1, 1},
+    {"union", SdfNode::UNION, 0, 1, size_t(-1)},
+    {"intersection", SdfNode::INTERSECTION, 0, 1, size_t(-1)},
+    {"smooth_union", SdfNode::SMOOTH_UNION, 1, 2, 2},
+    {"displace", SdfNode::DISPLACE, 2, 1, 1},
+};
+
+// "(", ")" or a word; empty at the end of the input
+std::string next_token(std::istream &in)
+{
+    int c;
+    while ((c = in.peek()) != EOF)
+    {
+        if (c == ';')
+            while ((c = in.get()) != EOF && c != '\n')
+                ;
+        else if (std::isspace(c))
+            in.get();
+        else
+            break;
+    }
+    if (c == EOF)
+        return "";
+    if (c == '(' || c == ')')
+        return std::string(1, (char)in.get());
+    std::string word;
+    while ((c = in.peek()) != EOF && !std::isspace(c) && c != '(' && c != ')' && c != ';')
+        word += (char)in.get();
+    return word;
+}
+
+bool parse_node(std::istream &in, const std::string &open, SdfNode &node, std::string &error)
+{
+    if (open != "(")
+    {
+        error = open.empty() ? "unexpected end of the scene" : "expected '(' instead of '" + open + "'";
+        return false;
+    }
+    std::string name = next_token(in);
+    const NodeSyntax *s = nullptr;
+    for (const NodeSyntax &candidate : syntax)
+        if (name == candidate.name)
+            s = &candidate;
+    if (!s)
+    {
+        error = "unknown node '" + name + "'";
+        return false;
+    }
+    node.kind = s->kind;
+    node.params.clear();
+    node.children.clear();
+    for (size_t i = 0; i < s->params; i++)
+    {
+        std::string word = next_token(in);
+        char *end = nullptr;
+        float v = std::strtof(word.c_str(), &end);
+        if (word.empty() || *end || !std::isfinite(v))
+        {
+            error = name + ": expected a number instead of '" + word + "'";
+            return false;
+        }
+        node.params.push_back(v);
+    }
+    for (std::string token = next_token(in);; token = next_token(in))
+    {
+        if (token == ")")
+            break;
+        if (node.children.size() == s->max_children)
+        {
+            error = name + (token.empty() ? ": missing ')'" : ": too many children");
+            return false;
+        }
+        node.children.push_back(SdfNode());
+        if (!parse_node(in, token, node.children.back(), error))
+            return false;
+    }
+    if (node.children.size() < s->min_children)
+    {
+        error = name + ": too few children";
+        return false;
+    }
+    if ((node.kind == SdfNode::SCALE && node.params[0] == 0) || (node.kind == SdfNode::SMOOTH_UNION && node.params[0] <= 0))
+    {
+        error = name + ": the parameter must be positive";
+        return false;
+    }
+    if (node.kind == SdfNode::PLANE) // the distance needs a unit normal
+    {
+        Vec3f n(node.params[0], node.params[1], node.params[2]);
+        if (n.norm() == 0)
+        {
+            error = "plane: zero normal";
+            return false;
+        }
+        n.normalize();
+        node.params[0] = n.x, node.params[1] = n.y, node.params[2] = n.z;
+    }
+    return true;
+}
+} // namespace
+
+bool parse_sdf_scene(std::istream &in, SdfNode &root, std::string &error)
+{
+    if (!parse_node(in, next_token(in), root, error))
+        return false;
+    std::string trailing = next_token(in);
+    if (!trailing.empty())
+    {
+        error = "unexpected '" + trailing + "' after the scene";
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------- compilation
+
+SdfProgram::SdfProgram(const SdfNode &root)
+{
+    result_ = 3;
+    registers_ = 4;
+    lipschitz_ = compile(root, 0, 1, 2, result_, 4);
+}
+
+void SdfProgram::emit(const Op op, const uint16_t dst, const uint16_t a, const uint16_t b, const uint16_t c, std::initializer_list<float> k)
+{
+    Instruction ins = {op, dst, a, b, c, (uint32_t)constants_.size()};
+    constants_.insert(constants_.end(), k);
+    code_.push_back(ins);
+    registers_ = std::max<uint16_t>(registers_, std::max(dst, std::max(a, std::max(b, c))) + 1);
+}
+
+// Emits n evaluated at the point in registers x, y, z into dst, using the registers from free on as scratch;
+// returns the node's Lipschitz bound
+float SdfProgram::compile(const SdfNode &n, const uint16_t x, const uint16_t y, const uint16_t z, const uint16_t dst, const uint16_t free)
+{
+    const std::vector<float> &p = n.params;
+    float lipschitz = 1;
+    switch (n.kind)
+    {
+    case SdfNode::SPHERE:
+        emit(OP_SPHERE, dst, x, y, z, {p[0]});
+        break;
+    case SdfNode::BOX:
+        emit(OP_BOX, dst, x, y, z, {p[0], p[1], p[2]});
+        break;
+    case SdfNode::TORUS:
+        emit(OP_TORUS, dst, x, y, z, {p[0], p[1]});
+        break;
+    case SdfNode::PLANE:
+        emit(OP_DOT3K, dst, x, y, z, {p[0], p[1], p[2]});
+        emit(OP_ADDK, dst, dst, 0, 0, {-p[3]});
+        break;
+    case SdfNode::TRANSLATE:
+        emit(OP_ADDK, free, x, 0, 0, {-p[0]});
+        emit(OP_ADDK, free + 1, y, 0, 0, {-p[1]});
+        emit(OP_ADDK, free + 2, z, 0, 0, {-p[2]});
+        lipschitz = compile(n.children[0], free, free + 1, free + 2, dst, free + 3);
+        break;
+    case SdfNode::SCALE:
+        emit(OP_MULK, free, x, 0, 0, {1.f / p[0]});
+        emit(OP_MULK, free + 1, y, 0, 0, {1.f / p[0]});
+        emit(OP_MULK, free + 2, z, 0, 0, {1.f / p[0]});
+        lipschitz = compile(n.children[0], free, free + 1, free + 2, dst, free + 3);
+        emit(OP_MULK, dst, dst, 0, 0, {std::abs(p[0])});
+        break;
+    case SdfNode::ROTATE_Y: // the inverse rotation takes the point into the child's frame, like rotate_y in sdf.h
+    {
+        float c = std::cos(p[0]), s = std::sin(p[0]);
+        emit(OP_DOT3K, free, x, y, z, {c, 0, -s});
+        emit(OP_DOT3K, free + 1, x, y, z, {s, 0, c});
+        lipschitz = compile(n.children[0], free, y, free + 1, dst, free + 2);
+        break;
+    }
+    case SdfNode::UNION:
+    case SdfNode::INTERSECTION: // folded left, the accumulator stays in dst
+        lipschitz = compile(n.children[0], x, y, z, dst, free);
+        for (size_t i = 1; i < n.children.size(); i++)
+        {
+            lipschitz = std::max(lipschitz, compile(n.children[i], x, y, z, free, free + 1));
+            emit(n.kind == SdfNode::UNION ? OP_MIN : OP_MAX, dst, dst, free, 0, {});
+        }
+        break;
+    case SdfNode::SMOOTH_UNION:
+        lipschitz = compile(n.children[0], x, y, z, dst, free);
+        lipschitz = std::max(lipschitz, compile(n.children[1], x, y, z, free, free + 1));
+        emit(OP_SMIN, dst, dst, free, 0, {p[0]});
+        break;
+    case SdfNode::DISPLACE:
+        lipschitz = compile(n.children[0], x, y, z, dst, free);
+        emit(OP_FBM, free, x, y, z, {p[1], p[0]});
+        emit(OP_ADD, dst, dst, free, 0, {});
+        lipschitz += std::abs(p[0]) * std::abs(p[1]) * FBM_SLOPE;
+        break;
+    }
+    return lipschitz;
+}
+
+// ---------------------------------------------------------------- evaluation
+
+static inline void sqrt_lanes(float *v) // NOISE_LANES values in place, bit-exact with std::sqrt
+{
+#if defined(__AVX__)
+    _mm256_storeu_ps(v, _mm256_sqrt_ps(_mm256_loadu_ps(v)));
+#elif defined(__SSE__)
+    _mm_storeu_ps(v, _mm_sqrt_ps(_mm_loadu_ps(v)));
+    _mm_storeu_ps(v + 4, _mm_sqrt_ps(_mm_loadu_ps(v + 4)));
+#else
+    for (int l = 0; l < NOISE_LANES; l++)
+        v[l] = std::sqrt(v[l]);
+#endif
+}
+
+// Each instruction is a loop over the lanes the compiler turns into a few vector instructions; the lanes go through
+// local arrays so it need not worry about dst aliasing the operands
+void SdfProgram::eval(const float *x, const float *y, const float *z, float *out) const
+{
+    const int L = NOISE_LANES;
+    static thread_local std::vector<float> file;
+    file.resize(registers_ * L);
+    float *r = file.data();
+    std::copy(x, x + L, r);
+    std::copy(y, y + L, r + L);
+    std::copy(z, z + L, r + 2 * L);
+    const float *constants = this->constants();
+    for (const Instruction &ins : code_)
+    {
+        const float *a = r + ins.a * L, *b = r + ins.b * L, *c = r + ins.c * L, *k = constants + ins.k;
+        float v[L];
+        switch (ins.op)
+        {
+        case OP_COPY:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l];
+            break;
+        case OP_ADD:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] + b[l];
+            break;
+        case OP_ADDK:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] + k[0];
+            break;
+        case OP_MULK:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] * k[0];
+            break;
+        case OP_DOT3K:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] * k[0] + b[l] * k[1] + c[l] * k[2];
+            break;
+        case OP_SPHERE:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] * a[l] + b[l] * b[l] + c[l] * c[l];
+            sqrt_lanes(v);
+            for (int l = 0; l < L; l++)
+                v[l] -= k[0];
+            break;
+        case OP_BOX:
+        {
+            float inside[L];
+            for (int l = 0; l < L; l++)
+            {
+                float qx = std::abs(a[l]) - k[0], qy = std::abs(b[l]) - k[1], qz = std::abs(c[l]) - k[2];
+                inside[l] = std::min(std::max(qx, std::max(qy, qz)), 0.f);
+                qx = std::max(qx, 0.f), qy = std::max(qy, 0.f), qz = std::max(qz, 0.f);
+                v[l] = qx * qx + qy * qy + qz * qz;
+            }
+            sqrt_lanes(v);
+            for (int l = 0; l < L; l++)
+                v[l] += inside[l];
+            break;
+        }
+        case OP_TORUS:
+            for (int l = 0; l < L; l++)
+                v[l] = a[l] * a[l] + c[l] * c[l];
+            sqrt_lanes(v);
+            for (int l = 0; l < L; l++)
+                v[l] = (v[l] - k[0]) * (v[l] - k[0]) + b[l] * b[l];
+            sqrt_lanes(v);
+            for (int l = 0; l < L; l++)
+                v[l] -= k[1];
+            break;
+        case OP_FBM:
+        {
+            float px[L], py[L], pz[L];
+            for (int l = 0; l < L; l++)
+                px[l] = a[l] * k[0], py[l] = b[l] * k[0], pz[l] = c[l] * k[0];
+            fractal_brownian_motion8(px, py, pz, v);
+            for (int l = 0; l < L; l++)
+                v[l] *= k[1];
+            break;
+        }
+        case OP_MIN:
+            for (int l = 0; l < L; l++)
+                v[l] = std::min(a[l], b[l]);
+            break;
+        case OP_MAX:
+            for (int l = 0; l < L; l++)
+                v[l] = std::max(a[l], b[l]);
+            break;
+        case OP_SMIN:
+            for (int l = 0; l < L; l++)
+            {
+                float h = std::max(k[0] - std::abs(a[l] - b[l]), 0.f) / k[0];
+                v[l] = std::min(a[l], b[l]) - h * h * k[0] * .25f;
+            }
+            break;
+        }
+        std::copy(v, v + L, r + ins.dst * L);
+    }
+    std::copy(r + result_ * L, r + (result_ + 1) * L, out);
+}
+
+// ---------------------------------------------------------------- interval arithmetic
+
+namespace
+{
+Interval operator+(const Interval a, const Interval b) { return {a.lo + b.lo, a.hi + b.hi}; }
+Interval operator+(const Interval a, const float k) { return {a.lo + k, a.hi + k}; }
+Interval operator*(const Interval a, const float k) { return k >= 0 ? Interval{a.lo * k, a.hi * k} : Interval{a.hi * k, a.lo * k}; }
+Interval min(const Interval a, const Interval b) { return {std::min(a.lo, b.lo), std::min(a.hi, b.hi)}; }
+Interval max(const Interval a, const Interval b) { return {std::max(a.lo, b.lo), std::max(a.hi, b.hi)}; }
+Interval max(const Interval a, const float k) { return {std::max(a.lo, k), std::max(a.hi, k)}; }
+Interval sqrt(const Interval a) { return {std::sqrt(std::max(a.lo, 0.f)), std::sqrt(std::max(a.hi, 0.f))}; }
+Interval abs(const Interval a)
+{
+    if (a.lo >= 0)
+        return a;
+    if (a.hi <= 0)
+        return {-a.hi, -a.lo};
+    return {0, std::max(-a.lo, a.hi)};
+}
+Interval square(const Interval a)
+{
+    Interval m = abs(a);
+    return {m.lo * m.lo, m.hi * m.hi};
+}
+
+// which children of a min / max / smooth minimum the result depends on: a choice is stored per instruction,
+// the low bits hold what the intervals prove, the high bits what a ray looking only for the surface needs
+enum Choice : uint8_t
+{
+    KEEP_BOTH = 0,
+    KEEP_A = 1,
+    KEEP_B = 2,
+    SURFACE_SHIFT = 2
+};
+} // namespace
+
+// runs the program on intervals; with choices, records for each instruction which operands it can do without
+void SdfProgram::forward(const Vec3f &lo, const Vec3f &hi, std::vector<Interval> &regs, std::vector<uint8_t> *choices) const
+{
+    regs.resize(registers_);
+    regs[0] = {lo.x, hi.x};
+    regs[1] = {lo.y, hi.y};
+    regs[2] = {lo.z, hi.z};
+    if (choices)
+        choices->assign(code_.size(), KEEP_BOTH);
+    for (size_t i = 0; i < code_.size(); i++)
+    {
+        const Instruction &ins = code_[i];
+        const Interval a = regs[ins.a], b = regs[ins.b], c = regs[ins.c];
+        const float *k = constants() + ins.k;
+        uint8_t choice = KEEP_BOTH;
+        Interval v = a;
+        switch (ins.op)
+        {
+        case OP_COPY:
+            break;
+        case OP_ADD:
+            v = a + b;
+            break;
+        case OP_ADDK:
+            v = a + k[0];
+            break;
+        case OP_MULK:
+            v = a * k[0];
+            break;
+        case OP_DOT3K:
+            v = a * k[0] + b * k[1] + c * k[2];
+            break;
+        case OP_SPHERE:
+            v = sqrt(square(a) + square(b) + square(c)) + -k[0];
+            break;
+        case OP_BOX:
+        {
+            Interval qx = abs(a) + -k[0], qy = abs(b) + -k[1], qz = abs(c) + -k[2];
+            Interval inside = min(max(qx, max(qy, qz)), Interval{0, 0});
+            v = sqrt(square(max(qx, 0.f)) + square(max(qy, 0.f)) + square(max(qz, 0.f))) + inside;
+            break;
+        }
+        case OP_TORUS:
+            v = sqrt(square(sqrt(square(a) + square(c)) + -k[0]) + square(b)) + -k[1];
+            break;
+        case OP_FBM: // fractal_brownian_motion is in [0, 1)
+            v = Interval{0, 1} * k[1];
+            break;
+        case OP_MIN:
+            v = min(a, b);
+            choice = a.lo >= b.hi ? KEEP_B : b.lo >= a.hi ? KEEP_A : KEEP_BOTH;
+            if (a.lo > 0 && b.lo > 0) // no surface either way, one of them is enough to step with
+                choice |= (a.lo <= b.lo ? KEEP_A : KEEP_B) << SURFACE_SHIFT;
+            else if (a.lo > 0)
+                choice |= KEEP_B << SURFACE_SHIFT;
+            else if (b.lo > 0)
+                choice |= KEEP_A << SURFACE_SHIFT;
+            break;
+        case OP_MAX:
+            v = max(a, b);
+            choice = a.lo >= b.hi ? KEEP_A : b.lo >= a.hi ? KEEP_B : KEEP_BOTH;
+            break;
+        case OP_SMIN: // the blend only reaches k / 4 below the minimum, and only where a and b are within k
+            v = min(a, b);
+            v.lo -= k[0] * .25f;
+            choice = a.lo - b.hi >= k[0] ? KEEP_B : b.lo - a.hi >= k[0] ? KEEP_A : KEEP_BOTH;
+            if (choice)
+                v = choice == KEEP_A ? a : b;
+            break;
+        }
+        regs[ins.dst] = v;
+        if (choices)
+            (*choices)[i] = choice;
+    }
+}
+
+Interval SdfProgram::bound(const Vec3f &lo, const Vec3f &hi) const
+{
+    static thread_local std::vector<Interval> regs;
+    forward(lo, hi, regs, nullptr);
+    return regs[result_];
+}
+
+// Backwards from the result, like a liveness pass: each register carries what its next reader needs from it, nothing
+// (the instruction writing it is dead), only the surface, or the value. Min keeps passing "only the surface" down
+// into its children, everything else needs values.
+Interval SdfProgram::prune(const Vec3f &lo, const Vec3f &hi, SdfProgram &pruned) const
+{
+    enum Need : uint8_t
+    {
+        NEED_NOTHING,
+        NEED_SURFACE,
+        NEED_VALUE
+    };
+    static thread_local std::vector<Interval> regs;
+    static thread_local std::vector<uint8_t> choices, need;
+    forward(lo, hi, regs, &choices);
+
+    pruned.code_.clear();
+    pruned.constants_.clear(); // the kept instructions still point into ours
+    pruned.shared_ = constants();
+    pruned.registers_ = registers_;
+    pruned.result_ = result_;
+    pruned.lipschitz_ = lipschitz_;
+    need.assign(registers_, NEED_NOTHING);
+    need[result_] = NEED_SURFACE;
+    for (size_t i = code_.size(); i-- > 0;)
+    {
+        Instruction ins = code_[i];
+        const uint8_t needed = need[ins.dst];
+        if (needed == NEED_NOTHING)
+            continue;
+        need[ins.dst] = NEED_NOTHING;
+        uint8_t child = NEED_VALUE;
+        bool binary = false, ternary = false;
+        switch (ins.op)
+        {
+        case OP_COPY:
+            child = needed;
+            break;
+        case OP_MULK: // scaling by a positive factor keeps the surface where it is
+            child = constants()[ins.k] > 0 ? needed : (uint8_t)NEED_VALUE;
+            break;
+        case OP_ADD:
+            binary = true;
+            break;
+        case OP_DOT3K:
+        case OP_SPHERE:
+        case OP_BOX:
+        case OP_TORUS:
+        case OP_FBM:
+            ternary = true;
+            break;
+        case OP_MIN:
+        case OP_MAX:
+        case OP_SMIN:
+        {
+            uint8_t keep = choices[i] & 3;
+            if (!keep && ins.op == OP_MIN && needed == NEED_SURFACE)
+                keep = choices[i] >> SURFACE_SHIFT;
+            if (ins.op == OP_MIN)
+                child = needed;
+            if (keep)
+            {
+                ins.op = OP_COPY;
+                ins.a = keep == KEEP_A ? ins.a : ins.b;
+            }
+            else
+                binary = true;
+            break;
+        }
+        default:
+            break;
+        }
+        if (ins.op == OP_COPY && ins.a == ins.dst)
+        {
+            need[ins.a] = std::max(need[ins.a], child);
+            continue;
+        }
+        need[ins.a] = std::max(need[ins.a], child);
+        if (binary || ternary)
+            need[ins.b] = std::max(need[ins.b], child);
+        if (ternary)
+            need[ins.c] = std::max(need[ins.c], child);
+        pruned.code_.push_back(ins);
+    }
+    std::reverse(pruned.code_.begin(), pruned.code_.end());
+    return regs[result_];
+}
@@ -0,0 +1,99 @@
+#ifndef __SDF_PROGRAM_H__
+#define __SDF_PROGRAM_H__
+#include <cstdint>
+#include <initializer_list>
+#include <istream>
+#include <string>
+#include <vector>
+#include "geometry.h"
+#include "noise.h"
+
+// Scenes defined at runtime, the nodes of sdf.h read from text. A scene is one s-expression, e.g.
+//   (union (displace 1 3.4 (sphere 1.75))
+//          (translate 0 -2 0 (box 4 .1 4)))
+// primitives: (sphere r) (box hx hy hz) (torus major minor) (plane nx ny nz offset)
+// transforms: (translate x y z child) (scale s child) (rotate_y radians child)
+// combinations: (union child...) (intersection child...) (smooth_union k a b) (displace amplitude frequency child)
+// Anything from ';' to the end of the line is a comment.
+struct SdfNode
+{
+    enum Kind
+    {
+        SPHERE, BOX, TORUS, PLANE, TRANSLATE, SCALE, ROTATE_Y, UNION, INTERSECTION, SMOOTH_UNION, DISPLACE
+    } kind;
+    std::vector<float> params;
+    std::vector<SdfNode> children;
+    size_t count() const; // nodes in the subtree
+};
+
+bool parse_sdf_scene(std::istream &in, SdfNode &root, std::string &error); // error names the offending token
+
+struct Interval
+{
+    float lo, hi;
+};
+
+// fractal_brownian_motion changes by at most about this much per unit of distance; not a true bound (the noise is
+// not continuous across cell borders), but 1 + 3.4 * FBM_SLOPE is the march.lipschitz = 10 the fireball uses
+const float FBM_SLOPE = 2.65f;
+
+// The scene flattened into register code. A register holds NOISE_LANES floats; registers 0, 1 and 2 are the x, y
+// and z of the points, the others are allocated like a stack while the tree is compiled, so a union of thousands of
+// children still needs only a handful. Points are transformed by the same scalar instructions the distances use.
+class SdfProgram
+{
+public:
+    enum Op : uint8_t
+    {
+        OP_COPY,   // dst = a
+        OP_ADD,    // dst = a + b
+        OP_ADDK,   // dst = a + k0
+        OP_MULK,   // dst = a * k0
+        OP_DOT3K,  // dst = a * k0 + b * k1 + c * k2
+        OP_SPHERE, // dst = |(a, b, c)| - k0
+        OP_BOX,    // dst = box of half extents k0 k1 k2 at (a, b, c)
+        OP_TORUS,  // dst = torus k0 k1 at (a, b, c)
+        OP_FBM,    // dst = fractal_brownian_motion((a, b, c) * k0) * k1
+        OP_MIN,    // dst = min(a, b)
+        OP_MAX,    // dst = max(a, b)
+        OP_SMIN    // dst = smooth minimum of a and b, blend radius k0
+    };
+    struct Instruction
+    {
+        Op op;
+        uint16_t dst, a, b, c;
+        uint32_t k; // first constant
+    };
+
+    SdfProgram() {}
+    explicit SdfProgram(const SdfNode &root);
+
+    // distances at NOISE_LANES points, structure-of-arrays like fractal_brownian_motion8
+    void eval(const float *x, const float *y, const float *z, float *out) const;
+    // bounds of the distance over the axis-aligned box [lo, hi] (up to float rounding)
+    Interval bound(const Vec3f &lo, const Vec3f &hi) const;
+    // Writes into pruned the part of the program a ray inside the box can see: the children of min / max / smooth
+    // minimum that the intervals prove can never be chosen are dropped, and so are the members of the top-level
+    // unions that have no surface in the box (the ray never meets them there, the rest still bounds the distance to
+    // what it does meet). Returns the bounds over the box; lo > 0 means no surface in it at all.
+    // The pruned program shares this one's constants, so it must not outlive it.
+    Interval prune(const Vec3f &lo, const Vec3f &hi, SdfProgram &pruned) const;
+
+    size_t size() const { return code_.size(); }
+    size_t registers() const { return registers_; }
+    float lipschitz() const { return lipschitz_; } // bound on the distance's slope, steps are distance / lipschitz
+
+private:
+    std::vector<Instruction> code_;
+    std::vector<float> constants_;
+    const float *shared_ = nullptr; // constants of the program this one was pruned from, instead of constants_
+    uint16_t registers_ = 3, result_ = 0;
+    float lipschitz_ = 1;
+
+    const float *constants() const { return shared_ ? shared_ : constants_.data(); }
+    float compile(const SdfNode &n, const uint16_t x, const uint16_t y, const uint16_t z, const uint16_t dst, const uint16_t free);
+    void emit(const Op op, const uint16_t dst, const uint16_t a, const uint16_t b, const uint16_t c, std::initializer_list<float> k);
+    void forward(const Vec3f &lo, const Vec3f &hi, std::vector<Interval> &regs, std::vector<uint8_t> *choices) const;
+};
+
+#endif //__SDF_PROGRAM_H__
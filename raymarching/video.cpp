@@ -0,0 +1,531 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "video.h"
+
+// row j as RGB8, converted into scratch (w * 3 bytes) unless the storage is RGB8 already
+static const uint8_t *rgb8_row(const FrameBuffer &fb, const size_t j, uint8_t *scratch)
+{
+    const uint8_t *src = fb.row(j);
+    if (fb.format == PIXEL_RGBA16F)
+        convert_rgba16f_to_rgb8(reinterpret_cast<const uint16_t *>(src), scratch, fb.w);
+    else if (fb.format == PIXEL_RGB32F)
+        convert_rgb32f_to_rgb8(reinterpret_cast<const float *>(src), scratch, fb.w);
+    else
+        return src;
+    return scratch;
+}
+
+// Y, U and V planes of a width x height frame (the chroma planes rounded up), width and height padded by repeating
+// the last column and row: Y is pitch wide, U and V pitch / 2
+static void yuv420_planes(const FrameBuffer &fb, const size_t pitch, const size_t rows, const bool full_range,
+                          std::vector<uint8_t> &rgb, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+    rgb.resize(4 * pitch * 3);
+    uint8_t *scratch = rgb.data(), *padded[2] = {rgb.data() + 2 * pitch * 3, rgb.data() + 3 * pitch * 3};
+    for (size_t j = 0; j < rows; j += 2)
+    {
+        for (size_t k = 0; k < 2; k++)
+        {
+            const uint8_t *src = rgb8_row(fb, std::min(j + k, fb.h - 1), scratch + k * pitch * 3);
+            memcpy(padded[k], src, fb.w * 3);
+            for (size_t i = fb.w; i < pitch; i++)
+                memcpy(padded[k] + 3 * i, src + 3 * (fb.w - 1), 3);
+        }
+        uint8_t *y1 = j + 1 < rows ? y + (j + 1) * pitch : scratch; // an odd last row goes nowhere
+        convert_rgb8_to_yuv420(padded[0], padded[1], y + j * pitch, y1, u + j / 2 * (pitch / 2), v + j / 2 * (pitch / 2), pitch, full_range);
+    }
+}
+
+// ---------------------------------------------------------------- PPM
+
+bool PpmWriter::write(const FrameBuffer &fb, const int frame)
+{
+    std::string file = prefix_ + std::to_string(frame) + ".ppm";
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    fb.drop_ppm_image(file);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return !manifest_ || manifest_->record(frame, file, seconds);
+}
+
+// ---------------------------------------------------------------- Y4M
+
+Y4mWriter::Y4mWriter(const std::string &path, const size_t width, const size_t height, const int fps)
+    : file_(path == "-" ? stdout : std::fopen(path.c_str(), "wb")), ok_(true)
+{
+    if (file_) // C420jpeg: the chroma samples sit between the luma samples, as the 2x2 average puts them
+        ok_ = std::fprintf(file_, "YUV4MPEG2 W%zu H%zu F%d:1 Ip A1:1 C420jpeg\n", width, height, fps) > 0;
+}
+
+Y4mWriter::~Y4mWriter()
+{
+    close();
+}
+
+bool Y4mWriter::write(const FrameBuffer &fb, const int)
+{
+    if (!ok())
+        return false;
+    const size_t pitch = (fb.w + 1) & ~size_t(1), rows = (fb.h + 1) & ~size_t(1);
+    const size_t chroma = pitch / 2 * (rows / 2);
+    planes_.resize(pitch * rows + 2 * chroma);
+    uint8_t *y = planes_.data(), *u = y + pitch * rows, *v = u + chroma;
+    yuv420_planes(fb, pitch, fb.h, false, rgb_, y, u, v);
+    ok_ = std::fputs("FRAME\n", file_) >= 0;
+    for (size_t j = 0; ok_ && j < fb.h; j++)
+        ok_ = std::fwrite(y + j * pitch, 1, fb.w, file_) == fb.w;
+    const size_t cw = (fb.w + 1) / 2, ch = (fb.h + 1) / 2;
+    for (uint8_t *plane : {u, v})
+        for (size_t j = 0; ok_ && j < ch; j++)
+            ok_ = std::fwrite(plane + j * (pitch / 2), 1, cw, file_) == cw;
+    return ok_;
+}
+
+bool Y4mWriter::close()
+{
+    if (!file_)
+        return ok_;
+    ok_ = std::fflush(file_) == 0 && ok_;
+    if (file_ != stdout)
+        ok_ = std::fclose(file_) == 0 && ok_;
+    file_ = nullptr;
+    return ok_;
+}
+
+// ---------------------------------------------------------------- JPEG
+
+namespace
+{
+const uint8_t zigzag[64] = { // natural index of each zigzag position
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// the example tables of the standard (annex K), natural order
+const uint8_t luma_quant[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+const uint8_t chroma_quant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t dc_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const uint8_t ac_luma_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81,
+    0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18,
+    0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+    0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5,
+    0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+const uint8_t ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const uint8_t ac_chroma_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08,
+    0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+    0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+    0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4,
+    0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+struct HuffmanTable // canonical codes of the symbols, from the code length counts and the symbols in code order
+{
+    uint16_t code[256];
+    uint8_t length[256];
+    HuffmanTable(const uint8_t *bits, const uint8_t *values)
+    {
+        uint16_t next = 0;
+        for (int len = 1, k = 0; len <= 16; len++, next <<= 1)
+            for (int n = 0; n < bits[len - 1]; n++, k++)
+            {
+                code[values[k]] = next++;
+                length[values[k]] = len;
+            }
+    }
+};
+const HuffmanTable dc_luma(dc_luma_bits, dc_values), dc_chroma(dc_chroma_bits, dc_values);
+const HuffmanTable ac_luma(ac_luma_bits, ac_luma_values), ac_chroma(ac_chroma_bits, ac_chroma_values);
+
+class BitWriter // most significant bit first, a 0 byte stuffed after each 0xff
+{
+public:
+    explicit BitWriter(std::vector<uint8_t> &out) : out_(out), buffer_(0), count_(0) {}
+    void put(const uint32_t bits, const int length)
+    {
+        buffer_ = (buffer_ << length) | (bits & ((1u << length) - 1));
+        count_ += length;
+        while (count_ >= 8)
+        {
+            uint8_t byte = (uint8_t)(buffer_ >> (count_ - 8));
+            out_.push_back(byte);
+            if (byte == 0xff)
+                out_.push_back(0);
+            count_ -= 8;
+        }
+    }
+    void flush() { put(0x7f, 7); } // pad the last byte with ones
+private:
+    std::vector<uint8_t> &out_;
+    uint32_t buffer_;
+    int count_;
+};
+
+// AAN forward DCT of 8 values stride apart; the outputs are off by the factors the quantization divides out
+void fdct8(float *d, const int stride)
+{
+    float tmp0 = d[0] + d[7 * stride], tmp7 = d[0] - d[7 * stride];
+    float tmp1 = d[stride] + d[6 * stride], tmp6 = d[stride] - d[6 * stride];
+    float tmp2 = d[2 * stride] + d[5 * stride], tmp5 = d[2 * stride] - d[5 * stride];
+    float tmp3 = d[3 * stride] + d[4 * stride], tmp4 = d[3 * stride] - d[4 * stride];
+
+    float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3, tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    d[0] = tmp10 + tmp11;
+    d[4 * stride] = tmp10 - tmp11;
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * stride] = tmp13 + z1;
+    d[6 * stride] = tmp13 - z1;
+
+    tmp10 = tmp4 + tmp5, tmp11 = tmp5 + tmp6, tmp12 = tmp6 + tmp7;
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = tmp10 * 0.541196100f + z5, z4 = tmp12 * 1.306562965f + z5, z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3, z13 = tmp7 - z3;
+    d[5 * stride] = z13 + z2;
+    d[3 * stride] = z13 - z2;
+    d[stride] = z11 + z4;
+    d[7 * stride] = z11 - z4;
+}
+
+struct QuantTable
+{
+    uint8_t zigzag[64]; // the table as DQT stores it
+    float scale[64];    // natural order, 1 / (q * the DCT's factors)
+    QuantTable(const uint8_t *base, const int quality)
+    {
+        static const float aan[8] = {1.f, 1.387039845f, 1.306562965f, 1.175875602f, 1.f, 0.785694958f, 0.541196100f, 0.275899379f};
+        int q = std::max(1, std::min(100, quality));
+        int percent = q < 50 ? 5000 / q : 200 - 2 * q; // the IJG scaling
+        for (int k = 0; k < 64; k++)
+        {
+            int natural = ::zigzag[k];
+            int value = std::max(1, std::min(255, (base[natural] * percent + 50) / 100));
+            zigzag[k] = (uint8_t)value;
+            scale[natural] = 1.f / (value * aan[natural / 8] * aan[natural % 8] * 8.f);
+        }
+    }
+};
+
+void encode_block(BitWriter &bits, const uint8_t *samples, const size_t pitch, const QuantTable &quant, const HuffmanTable &dc,
+                  const HuffmanTable &ac, int &previous_dc)
+{
+    float block[64];
+    for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 8; x++)
+            block[y * 8 + x] = samples[y * pitch + x] - 128.f;
+    for (int k = 0; k < 8; k++)
+        fdct8(block + 8 * k, 1);
+    for (int k = 0; k < 8; k++)
+        fdct8(block + k, 8);
+    int coefficients[64], last = 0;
+    for (int k = 0; k < 64; k++)
+    {
+        coefficients[k] = (int)std::lround(block[zigzag[k]] * quant.scale[zigzag[k]]);
+        if (coefficients[k])
+            last = k;
+    }
+    // a value goes out as its bit count (the Huffman coded category) followed by its bits, ones' complement if negative
+    auto put_value = [&](const HuffmanTable &table, const int run, const int value) {
+        int magnitude = std::abs(value), size = 0;
+        while (magnitude >> size)
+            size++;
+        int symbol = run << 4 | size;
+        bits.put(table.code[symbol], table.length[symbol]);
+        if (size)
+            bits.put(value < 0 ? value - 1 : value, size);
+    };
+    put_value(dc, 0, coefficients[0] - previous_dc);
+    previous_dc = coefficients[0];
+    int run = 0;
+    for (int k = 1; k <= last; k++)
+    {
+        if (!coefficients[k])
+        {
+            run++;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+            bits.put(ac.code[0xf0], ac.length[0xf0]); // sixteen zeros
+        put_value(ac, run, coefficients[k]);
+        run = 0;
+    }
+    if (last < 63)
+        bits.put(ac.code[0], ac.length[0]); // end of block
+}
+
+void put16(std::vector<uint8_t> &out, const size_t v)
+{
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+} // namespace
+
+void encode_jpeg(const FrameBuffer &fb, const int quality, std::vector<uint8_t> &out)
+{
+    const QuantTable luma(luma_quant, quality), chroma(chroma_quant, quality);
+    const size_t pitch = (fb.w + 15) & ~size_t(15), rows = (fb.h + 15) & ~size_t(15); // whole 16x16 MCUs
+    static thread_local std::vector<uint8_t> planes, rgb;
+    planes.resize(pitch * rows * 3 / 2);
+    uint8_t *y = planes.data(), *u = y + pitch * rows, *v = u + pitch * rows / 4;
+    yuv420_planes(fb, pitch, rows, true, rgb, y, u, v);
+
+    static const uint8_t header[] = {0xff, 0xd8,                                                      // SOI
+                                     0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0}; // JFIF 1.1, no density
+    out.insert(out.end(), header, header + sizeof(header));
+    out.insert(out.end(), {0xff, 0xdb, 0, 132, 0});
+    out.insert(out.end(), luma.zigzag, luma.zigzag + 64);
+    out.push_back(1);
+    out.insert(out.end(), chroma.zigzag, chroma.zigzag + 64);
+    out.insert(out.end(), {0xff, 0xc0, 0, 17, 8});
+    put16(out, fb.h);
+    put16(out, fb.w);
+    out.insert(out.end(), {3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1}); // Y sampled 2x2 against Cb and Cr
+    out.insert(out.end(), {0xff, 0xc4, 0x01, 0xa2});
+    const uint8_t *tables[4][2] = {{dc_luma_bits, dc_values}, {ac_luma_bits, ac_luma_values}, {dc_chroma_bits, dc_values}, {ac_chroma_bits, ac_chroma_values}};
+    const uint8_t classes[4] = {0x00, 0x10, 0x01, 0x11};
+    for (int t = 0; t < 4; t++)
+    {
+        out.push_back(classes[t]);
+        out.insert(out.end(), tables[t][0], tables[t][0] + 16);
+        size_t count = 0;
+        for (int k = 0; k < 16; k++)
+            count += tables[t][0][k];
+        out.insert(out.end(), tables[t][1], tables[t][1] + count);
+    }
+    out.insert(out.end(), {0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+
+    BitWriter bits(out);
+    int dc[3] = {0, 0, 0};
+    for (size_t my = 0; my < rows; my += 16)
+        for (size_t mx = 0; mx < pitch; mx += 16)
+        {
+            for (size_t k = 0; k < 4; k++)
+                encode_block(bits, y + (my + k / 2 * 8) * pitch + mx + k % 2 * 8, pitch, luma, dc_luma, ac_luma, dc[0]);
+            encode_block(bits, u + my / 2 * (pitch / 2) + mx / 2, pitch / 2, chroma, dc_chroma, ac_chroma, dc[1]);
+            encode_block(bits, v + my / 2 * (pitch / 2) + mx / 2, pitch / 2, chroma, dc_chroma, ac_chroma, dc[2]);
+        }
+    bits.flush();
+    out.insert(out.end(), {0xff, 0xd9}); // EOI
+}
+
+// ---------------------------------------------------------------- AVI
+
+namespace
+{
+void put_fourcc(std::FILE *f, const char *fourcc) { std::fwrite(fourcc, 1, 4, f); }
+void put32(std::FILE *f, const uint32_t v)
+{
+    const uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    std::fwrite(b, 1, 4, f);
+}
+void put16(std::FILE *f, const uint16_t v)
+{
+    const uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    std::fwrite(b, 1, 2, f);
+}
+void patch32(std::FILE *f, const long offset, const uint32_t v)
+{
+    std::fseek(f, offset, SEEK_SET);
+    put32(f, v);
+}
+
+// offsets of the fields patched on close, given the fixed header layout written below
+const long RIFF_SIZE = 4, AVIH_TOTAL_FRAMES = 48, AVIH_BUFFER = 60, STRH_LENGTH = 140, STRH_BUFFER = 144, MOVI_SIZE = 216;
+} // namespace
+
+MjpegAviWriter::MjpegAviWriter(const std::string &path, const size_t width, const size_t height, const int fps, const int quality)
+    : file_(std::fopen(path.c_str(), "wb")), ok_(true), width_(width), height_(height), fps_(fps), quality_(quality), movi_(0), largest_(0)
+{
+    if (!file_)
+        return;
+    std::FILE *f = file_;
+    put_fourcc(f, "RIFF");
+    put32(f, 0); // patched
+    put_fourcc(f, "AVI ");
+    put_fourcc(f, "LIST");
+    put32(f, 4 + 8 + 56 + 12 + 8 + 56 + 8 + 40);
+    put_fourcc(f, "hdrl");
+    put_fourcc(f, "avih");
+    put32(f, 56);
+    put32(f, 1000000 / fps); // microseconds per frame
+    put32(f, 0);             // max bytes per second
+    put32(f, 0);             // padding granularity
+    put32(f, 0x10);          // AVIF_HASINDEX
+    put32(f, 0);             // total frames, patched
+    put32(f, 0);             // initial frames
+    put32(f, 1);             // streams
+    put32(f, 0);             // suggested buffer size, patched
+    put32(f, width);
+    put32(f, height);
+    for (int k = 0; k < 4; k++)
+        put32(f, 0);
+    put_fourcc(f, "LIST");
+    put32(f, 4 + 8 + 56 + 8 + 40);
+    put_fourcc(f, "strl");
+    put_fourcc(f, "strh");
+    put32(f, 56);
+    put_fourcc(f, "vids");
+    put_fourcc(f, "MJPG");
+    put32(f, 0); // flags
+    put16(f, 0); // priority
+    put16(f, 0); // language
+    put32(f, 0); // initial frames
+    put32(f, 1); // scale
+    put32(f, fps); // rate: fps / 1 frames per second
+    put32(f, 0); // start
+    put32(f, 0); // length, patched
+    put32(f, 0); // suggested buffer size, patched
+    put32(f, 0xffffffff); // default quality
+    put32(f, 0); // sample size
+    put16(f, 0), put16(f, 0), put16(f, width), put16(f, height); // frame rectangle
+    put_fourcc(f, "strf");
+    put32(f, 40); // BITMAPINFOHEADER
+    put32(f, 40);
+    put32(f, width);
+    put32(f, height);
+    put16(f, 1);  // planes
+    put16(f, 24); // bits per pixel
+    put_fourcc(f, "MJPG");
+    put32(f, width * height * 3);
+    for (int k = 0; k < 4; k++)
+        put32(f, 0);
+    put_fourcc(f, "LIST");
+    put32(f, 0); // patched
+    movi_ = std::ftell(f);
+    put_fourcc(f, "movi");
+    ok_ = movi_ == MOVI_SIZE + 4 && !std::ferror(f);
+}
+
+MjpegAviWriter::~MjpegAviWriter()
+{
+    close();
+}
+
+bool MjpegAviWriter::write(const FrameBuffer &fb, const int)
+{
+    if (!ok())
+        return false;
+    jpeg_.clear();
+    encode_jpeg(fb, quality_, jpeg_);
+    const size_t size = jpeg_.size();
+    index_.push_back((uint32_t)(std::ftell(file_) - movi_));
+    index_.push_back((uint32_t)size);
+    largest_ = std::max(largest_, size);
+    if (size & 1) // chunks are padded to even sizes
+        jpeg_.push_back(0);
+    put_fourcc(file_, "00dc");
+    put32(file_, size);
+    ok_ = std::fwrite(jpeg_.data(), 1, jpeg_.size(), file_) == jpeg_.size();
+    return ok_;
+}
+
+bool MjpegAviWriter::close()
+{
+    if (!file_)
+        return ok_;
+    std::FILE *f = file_;
+    const uint32_t frames = index_.size() / 2;
+    const long movi_end = std::ftell(f);
+    put_fourcc(f, "idx1");
+    put32(f, frames * 16);
+    for (uint32_t k = 0; k < frames; k++)
+    {
+        put_fourcc(f, "00dc");
+        put32(f, 0x10); // AVIIF_KEYFRAME, every frame is
+        put32(f, index_[2 * k]);
+        put32(f, index_[2 * k + 1]);
+    }
+    const long end = std::ftell(f);
+    patch32(f, RIFF_SIZE, end - 8);
+    patch32(f, AVIH_TOTAL_FRAMES, frames);
+    patch32(f, AVIH_BUFFER, largest_ + 8);
+    patch32(f, STRH_LENGTH, frames);
+    patch32(f, STRH_BUFFER, largest_ + 8);
+    patch32(f, MOVI_SIZE, movi_end - movi_);
+    ok_ = !std::ferror(f) && ok_;
+    ok_ = std::fclose(f) == 0 && ok_;
+    file_ = nullptr;
+    return ok_;
+}
+
+// ---------------------------------------------------------------- the encoding thread
+
+FrameEncoder::FrameEncoder(FrameSink &sink, const size_t slots, const size_t width, const size_t height, const PixelFormat format)
+    : sink_(sink), slots_(std::max<size_t>(1, slots), Slot{FrameBuffer(width, height, format), 0, false}), next_(0), done_(false), ok_(true),
+      busy_(0), stalled_(0)
+{
+    thread_ = std::thread(&FrameEncoder::run, this);
+}
+
+FrameEncoder::~FrameEncoder()
+{
+    finish();
+}
+
+FrameBuffer &FrameEncoder::acquire(const size_t sequence)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&] { return sequence < next_ + slots_.size(); }); // the slot's previous frame is written
+    stalled_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return slots_[sequence % slots_.size()].fb;
+}
+
+void FrameEncoder::release(const size_t sequence, const int frame)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot &slot = slots_[sequence % slots_.size()];
+    slot.frame = frame;
+    slot.full = true;
+    changed_.notify_all();
+}
+
+void FrameEncoder::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        Slot &slot = slots_[next_ % slots_.size()];
+        changed_.wait(lock, [&] { return slot.full || done_; });
+        if (!slot.full)
+            return;
+        lock.unlock();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool written = sink_.write(slot.fb, slot.frame);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        lock.lock();
+        busy_ += seconds;
+        ok_ = ok_ && written;
+        slot.full = false;
+        next_++;
+        changed_.notify_all();
+    }
+}
+
+bool FrameEncoder::finish()
+{
+    if (thread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            changed_.notify_all();
+        }
+        thread_.join();
+        ok_ = sink_.close() && ok_;
+    }
+    return ok_;
+}
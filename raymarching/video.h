@@ -0,0 +1,109 @@
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "framebuffer.h"
+#include "manifest.h"
+
+// Where the rendered frames go, one call per frame in order. The sinks encode on the calling thread, FrameEncoder
+// runs one on a thread of its own.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+    virtual bool write(const FrameBuffer &fb, const int frame) = 0; // frame: the animation's frame number; false on I/O errors
+    virtual bool close() { return true; }                           // finishes the output, false on I/O errors
+};
+
+// One PPM file per frame, prefix + frame number + ".ppm", each entered into the manifest if there is one
+class PpmWriter : public FrameSink
+{
+public:
+    explicit PpmWriter(const std::string &prefix, FrameManifest *manifest = nullptr) : prefix_(prefix), manifest_(manifest) {}
+    bool write(const FrameBuffer &fb, const int frame);
+
+private:
+    std::string prefix_;
+    FrameManifest *manifest_;
+};
+
+// YUV4MPEG2, 4:2:0 video range, to a file or to standard output ("-"), for piping into an encoder
+class Y4mWriter : public FrameSink
+{
+public:
+    Y4mWriter(const std::string &path, const size_t width, const size_t height, const int fps);
+    ~Y4mWriter();
+    bool ok() const { return file_ != nullptr && ok_; }
+    bool write(const FrameBuffer &fb, const int frame);
+    bool close();
+
+private:
+    std::FILE *file_;
+    bool ok_;
+    std::vector<uint8_t> rgb_, planes_; // scratch for one frame
+};
+
+// Baseline JPEG, 4:2:0, the standard tables scaled to quality (1..100); appended to out
+void encode_jpeg(const FrameBuffer &fb, const int quality, std::vector<uint8_t> &out);
+
+// Motion JPEG in an AVI container: every frame an independent JPEG. The headers are patched with the frame count on
+// close, so the path must be a seekable file.
+class MjpegAviWriter : public FrameSink
+{
+public:
+    MjpegAviWriter(const std::string &path, const size_t width, const size_t height, const int fps, const int quality);
+    ~MjpegAviWriter();
+    bool ok() const { return file_ != nullptr && ok_; }
+    bool write(const FrameBuffer &fb, const int frame);
+    bool close();
+
+private:
+    std::FILE *file_;
+    bool ok_;
+    size_t width_, height_;
+    int fps_, quality_;
+    long movi_; // offset of the 'movi' list's type, where the index offsets count from
+    std::vector<uint32_t> index_; // offset and size of each frame's chunk
+    size_t largest_;
+    std::vector<uint8_t> jpeg_;
+};
+
+// Runs a sink on a thread of its own, fed from a ring of framebuffers allocated once: a frame is rendered straight
+// into the slot acquire() hands out and released to the thread, which writes the slots in sequence order while the
+// next frames render into the others. Frames may be acquired out of order (by concurrent frame groups); acquire()
+// blocks while the frame a ring behind is not written yet, which bounds how far rendering runs ahead.
+class FrameEncoder
+{
+public:
+    FrameEncoder(FrameSink &sink, const size_t slots, const size_t width, const size_t height, const PixelFormat format);
+    ~FrameEncoder();
+    FrameBuffer &acquire(const size_t sequence);        // sequence numbers 0, 1, 2, ... without gaps
+    void release(const size_t sequence, const int frame); // the slot's frame is complete, frame: its animation frame number
+    bool finish(); // waits until every released frame is written, closes the sink; false if any write failed
+    double busy() const { return busy_; }     // seconds the thread spent writing
+    double stalled() const { return stalled_; } // seconds acquire() waited for a free slot, summed over the callers
+
+private:
+    struct Slot
+    {
+        FrameBuffer fb;
+        int frame;
+        bool full;
+    };
+    FrameSink &sink_;
+    std::vector<Slot> slots_;
+    size_t next_;         // sequence number the thread writes next
+    bool done_, ok_;
+    double busy_, stalled_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+    void run();
+};
+
+#endif //__VIDEO_H__
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "fast_math.h"
+#include "noise.h"
+#include "march.h"
+#include "volume.h"
+
+OccupancyGrid::OccupancyGrid(const float extent, const int cells, const float lipschitz, const int samples_per_cell)
+    : lo_(-extent), cell_(2 * extent / cells), cells_(cells), min_((size_t)cells * cells * cells), max_(min_.size()), build_seconds_(0)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    const int n = samples_per_cell + 1; // lattice points per cell edge, the corners included
+    const float spacing = cell_ / samples_per_cell;
+    const float slack = lipschitz * spacing * std::sqrt(3.f) / 2; // from a lattice point to the farthest point near it
+    const size_t points = (size_t)n * n * n, padded = (points + NOISE_LANES - 1) / NOISE_LANES * NOISE_LANES;
+#pragma omp parallel for collapse(2) schedule(dynamic)
+    for (int k = 0; k < cells_; k++)
+    {
+        for (int j = 0; j < cells_; j++)
+        {
+            std::vector<float> x(padded), y(padded), z(padded), fbm(padded), r(padded);
+            for (int i = 0; i < cells_; i++)
+            {
+                size_t s = 0;
+                for (int sz = 0; sz < n; sz++)
+                    for (int sy = 0; sy < n; sy++)
+                        for (int sx = 0; sx < n; sx++, s++)
+                        {
+                            Vec3f p(lo_ + i * cell_ + sx * spacing, lo_ + j * cell_ + sy * spacing, lo_ + k * cell_ + sz * spacing);
+                            r[s] = p.norm();
+                            x[s] = p.x * 3.4f, y[s] = p.y * 3.4f, z[s] = p.z * 3.4f;
+                        }
+                for (; s < padded; s++) // repeat the last point
+                    r[s] = r[s - 1], x[s] = x[s - 1], y[s] = y[s - 1], z[s] = z[s - 1];
+                for (s = 0; s < padded; s += NOISE_LANES)
+                    fractal_brownian_motion8(&x[s], &y[s], &z[s], &fbm[s]);
+                float lo = INFINITY, hi = -INFINITY;
+                for (s = 0; s < points; s++)
+                {
+                    float g = r[s] + fbm[s] * noise_amplitude;
+                    lo = std::min(lo, g);
+                    hi = std::max(hi, g);
+                }
+                min_[index(i, j, k)] = lo - slack;
+                max_[index(i, j, k)] = hi + slack;
+            }
+        }
+    }
+    build_seconds_ = std::chrono::duration<double>(clock::now() - start).count();
+}
+
+bool OccupancyGrid::locate(const Vec3f &p, const Vec3f &dir, const float t, int &i, int &j, int &k, float &t_leave) const
+{
+    float u = (p.x - lo_) / cell_, v = (p.y - lo_) / cell_, w = (p.z - lo_) / cell_;
+    if (!(u >= 0 && v >= 0 && w >= 0 && u < cells_ && v < cells_ && w < cells_)) // also catches NaN
+        return false;
+    i = u, j = v, k = w;
+    const int c[3] = {i, j, k};
+    t_leave = INFINITY;
+    for (int a = 0; a < 3; a++)
+    {
+        if (dir[a] == 0)
+            continue;
+        float wall = lo_ + (c[a] + (dir[a] > 0)) * cell_;
+        t_leave = std::min(t_leave, t + (wall - p[a]) / dir[a]);
+    }
+    return true;
+}
+
+void OccupancyGrid::report(const std::vector<float> &radii, std::ostream &out) const
+{
+    out << "occupancy grid: " << cells_ << "^3 cells of " << cell_ << ", built in " << build_seconds_ << " s; empty";
+    for (size_t r = 0; r < radii.size(); r++)
+    {
+        size_t empty = 0;
+        for (float m : min_)
+            empty += m >= radii[r];
+        out << (r ? ", " : " ") << 100. * empty / min_.size() << "% at radius " << radii[r];
+    }
+    out << std::endl;
+}
+
+Vec3f volume_march(const RenderContext &ctx, const Vec3f &eye, const Vec3f &ray, const Vec3f &background,
+                   Vec3f (*palette)(const float), int &samples, MarchEnd *end)
+{
+    samples = 0;
+    const Vec3f orig = object_point(ctx, eye), dir = object_point(ctx, ray); // the fireball's frame, the grids' too
+    // the fire lies inside the sphere: g >= |p|, so the density is zero wherever |p| >= sphere_radius
+    const float R = ctx.sphere_radius;
+    float b = orig * dir, disc = b * b - (orig * orig - R * R);
+    if (MARCH_STATS && end)
+        *end = MARCH_EXIT;
+    if (disc <= 0)
+        return background;
+    float t = std::max(0.f, -b - std::sqrt(disc)), t_exit = -b + std::sqrt(disc);
+    Vec3f color(0, 0, 0);
+    float transmittance = 1;
+    const float absorb = VOLUME_DENSITY * VOLUME_STEP;
+    float x[NOISE_LANES], y[NOISE_LANES], z[NOISE_LANES], r[NOISE_LANES], fbm[NOISE_LANES];
+    while (t < t_exit && transmittance > VOLUME_CUTOFF)
+    {
+        int i, j, k;
+        float t_leave;
+        if (ctx.volume->locate(orig + dir * t, dir, t, i, j, k, t_leave) && ctx.volume->empty(i, j, k, R))
+        {
+            t = std::max(t_leave, t + 1e-4f); // one stride across the cell
+            continue;
+        }
+        // the samples sit at the middles of the steps of a fixed lattice along the ray, so that skipping a cell
+        // does not shift the ones after it
+        const float first = std::ceil(t / VOLUME_STEP - .5f);
+        for (int s = 0; s < NOISE_LANES; s++)
+        {
+            Vec3f p = orig + dir * ((first + s + .5f) * VOLUME_STEP);
+            r[s] = hot_norm(p);
+            x[s] = p.x * 3.4f, y[s] = p.y * 3.4f, z[s] = p.z * 3.4f;
+        }
+        if (ctx.noise_grid)
+            for (int s = 0; s < NOISE_LANES; s++)
+                fbm[s] = ctx.noise_grid->sample(Vec3f(x[s], y[s], z[s]));
+        else
+            fractal_brownian_motion8(x, y, z, fbm);
+        for (int s = 0; s < NOISE_LANES && transmittance > VOLUME_CUTOFF; s++)
+        {
+            if ((first + s + .5f) * VOLUME_STEP >= t_exit)
+                break;
+            samples++;
+            float sd = r[s] + fbm[s] * noise_amplitude - R;
+            if (sd >= 0)
+                continue;
+            float alpha = 1 - std::exp(-std::min(1.f, -sd / VOLUME_EDGE) * absorb);
+            color = color + palette((-.2f + (R - r[s]) / noise_amplitude) * 2) * (transmittance * alpha);
+            transmittance *= 1 - alpha;
+        }
+        t = (first + NOISE_LANES) * VOLUME_STEP;
+    }
+    if (MARCH_STATS && end && transmittance <= VOLUME_CUTOFF)
+        *end = MARCH_HIT;
+    return color + background * transmittance;
+}
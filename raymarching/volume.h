@@ -0,0 +1,54 @@
+#ifndef __VOLUME_H__
+#define __VOLUME_H__
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "geometry.h"
+
+struct RenderContext;
+enum MarchEnd : uint8_t;
+
+// Bounds of the part of the fireball's distance that does not depend on the radius,
+// g(p) = |p| + fractal_brownian_motion(p * 3.4) * noise_amplitude (signed_distance = g - sphere_radius), over the
+// cells of a regular grid on the cube [-extent, extent]^3. A cell whose minimum is at least the radius holds no fire,
+// so one grid serves every frame of the animation. Each cell is sampled on a lattice of samples_per_cell^3 steps,
+// widened by lipschitz times half a step diagonal: the bounds hold wherever the Lipschitz bound does.
+class OccupancyGrid
+{
+public:
+    OccupancyGrid(const float extent, const int cells, const float lipschitz, const int samples_per_cell = 4);
+
+    int cells() const { return cells_; } // per axis
+    float cell_size() const { return cell_; }
+    bool empty(const int i, const int j, const int k, const float radius) const { return min_[index(i, j, k)] >= radius; }
+    float min(const int i, const int j, const int k) const { return min_[index(i, j, k)]; }
+    float max(const int i, const int j, const int k) const { return max_[index(i, j, k)]; }
+    // the cell containing p and where the ray leaves it; false if p is outside the grid
+    bool locate(const Vec3f &p, const Vec3f &dir, const float t, int &i, int &j, int &k, float &t_leave) const;
+
+    // build time and the share of the cells that are empty at the given radii
+    void report(const std::vector<float> &radii, std::ostream &out) const;
+
+private:
+    float lo_, cell_;
+    int cells_;
+    std::vector<float> min_, max_;
+    double build_seconds_;
+    size_t index(const int i, const int j, const int k) const { return ((size_t)k * cells_ + j) * cells_ + i; }
+};
+
+// The volumetric fire: a density that ramps up from 0 at the surface to VOLUME_DENSITY VOLUME_EDGE below it, glowing
+// in the palette colour of the depth below the sphere (the surface mode's colouring, carried inside), with emission
+// and absorption integrated in steps of VOLUME_STEP along the ray. The cells of ctx.volume that hold no fire are
+// crossed in one stride, the samples in the others are taken NOISE_LANES at a time, and the ray stops once less than
+// VOLUME_CUTOFF of the light behind it gets through. Returns the colour with the background behind; samples receives
+// the density evaluations and end, if given, MARCH_HIT for a ray stopped by the opacity, MARCH_EXIT otherwise (with
+// MARCH_STATS only).
+const float VOLUME_STEP = .02f;
+const float VOLUME_DENSITY = 30.f; // optical depth per unit of length
+const float VOLUME_EDGE = .1f;
+const float VOLUME_CUTOFF = 1.f / 256;
+Vec3f volume_march(const RenderContext &ctx, const Vec3f &eye, const Vec3f &ray, const Vec3f &background,
+                   Vec3f (*palette)(const float), int &samples, MarchEnd *end = nullptr);
+
+#endif //__VOLUME_H__
@@ -0,0 +1,170 @@
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "bench.h"
+#include "scene.h"
+#include "rng.h"
+
+// the sphere-only loop sceneIntersect used before primitive batches, kept verbatim as the baseline
+__attribute__((noinline)) static bool sphere_loop_intersect(const Vec3f &orig, const Vec3f &dir, const std::vector<Sphere> &scene, Vec3f &hit, Vec3f &N, Material &mat)
+{
+    float sphereDist = std::numeric_limits<float>::max();
+    for (const Sphere &s : scene)
+    {
+        if (s.ray_intersect(orig, dir, sphereDist))
+        {
+            hit = orig + dir * sphereDist;
+            N = (hit - s.center).normalize();
+            mat = s.material;
+        }
+    }
+    return sphereDist < 1000;
+}
+
+// what a "naive" heterogeneous scene would look like: one heap object per primitive behind a virtual call
+struct VirtualPrimitive
+{
+    virtual ~VirtualPrimitive() {}
+    virtual bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const = 0;
+    virtual Vec3f normal(const Vec3f &hit) const = 0;
+    virtual const Material &material() const = 0;
+};
+
+template <typename T>
+struct VirtualWrapper : VirtualPrimitive
+{
+    T prim;
+    VirtualWrapper(const T &p) : prim(p) {}
+    bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const { return prim.ray_intersect(p, dir, closestDist); }
+    Vec3f normal(const Vec3f &hit) const { return prim.normal(hit); }
+    const Material &material() const { return prim.material; }
+};
+
+typedef std::vector<std::unique_ptr<VirtualPrimitive>> VirtualScene;
+
+static bool virtual_intersect(const Vec3f &orig, const Vec3f &dir, const VirtualScene &scene, Vec3f &hit, Vec3f &N, Material &mat)
+{
+    float dist = std::numeric_limits<float>::max();
+    const VirtualPrimitive *closest = nullptr;
+    for (const std::unique_ptr<VirtualPrimitive> &p : scene)
+    {
+        if (p->ray_intersect(orig, dir, dist))
+            closest = p.get();
+    }
+    if (!closest)
+        return false;
+    hit = orig + dir * dist;
+    N = closest->normal(hit);
+    mat = closest->material();
+    return dist < 1000;
+}
+
+// n primitives of mixed types scattered in front of the camera; a naive scene list interleaves the types
+static void build_mixed_scene(size_t n, Scene &scene, VirtualScene &virtual_scene)
+{
+    Pcg32 rng(42, 7);
+    const Material mat = {1.0, Vec4f(0.6, 0.3, 0.1, 0.0), Vec3f(0.537, 0.812, 0.941), 50};
+    for (size_t i = 0; i < n; i++)
+    {
+        Vec3f c((rng.next_float() - .5f) * 30, (rng.next_float() - .5f) * 20, -10 - rng.next_float() * 30);
+        float r = .3f + rng.next_float();
+        switch (i % 8)
+        {
+        case 0:
+        case 1:
+        case 2:
+            scene.spheres.push_back(Sphere(c, r, mat));
+            virtual_scene.emplace_back(new VirtualWrapper<Sphere>(scene.spheres.back()));
+            break;
+        case 3:
+        case 4:
+        case 5:
+            scene.triangles.push_back(Triangle(c, c + Vec3f(r, 0, 0), c + Vec3f(0, r, r), mat));
+            virtual_scene.emplace_back(new VirtualWrapper<Triangle>(scene.triangles.back()));
+            break;
+        case 6:
+            scene.boxes.push_back(Box(c, c + Vec3f(r, r, r), mat));
+            virtual_scene.emplace_back(new VirtualWrapper<Box>(scene.boxes.back()));
+            break;
+        default:
+            if (scene.planes.empty()) // a floor, more planes would just hide everything
+            {
+                scene.planes.push_back(Plane(Vec3f(0, 1, 0), -12, mat));
+                virtual_scene.emplace_back(new VirtualWrapper<Plane>(scene.planes.back()));
+            }
+            else
+            {
+                scene.spheres.push_back(Sphere(c, r, mat));
+                virtual_scene.emplace_back(new VirtualWrapper<Sphere>(scene.spheres.back()));
+            }
+        }
+    }
+}
+
+// one pass over all rays, in millions of rays per second; hits and distances feed a checksum so nothing is optimized away
+template <typename Intersect>
+static double measure(const std::vector<Vec3f> &rays, Intersect intersect, double &checksum)
+{
+    typedef std::chrono::steady_clock clock;
+    checksum = 0;
+    clock::time_point start = clock::now();
+    for (const Vec3f &dir : rays)
+    {
+        Vec3f hit, N;
+        Material mat;
+        if (intersect(Vec3f(0, 0, 0), dir, hit, N, mat))
+            checksum += hit.z + N.x;
+    }
+    return rays.size() / std::chrono::duration<double>(clock::now() - start).count() * 1e-6;
+}
+
+void bench_primitives(std::ostream &out)
+{
+    const int width = 640, height = 480;
+    const int runs = 7; // the variants take turns and each keeps its best run, so clock drift hits all of them alike
+    std::vector<Vec3f> rays;
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+            rays.push_back(camera_ray(i + 0.5, j + 0.5, width, height, M_PI / 3.));
+
+    out << "scene\tprimitives\tsphere_loop\tbatched\tvirtual\t(Mrays/s)" << std::endl;
+    out << std::fixed << std::setprecision(2);
+
+    Scene spheres;
+    std::vector<Light> lights;
+    build_scene(spheres, lights);
+    VirtualScene virtual_spheres;
+    for (const Sphere &s : spheres.spheres)
+        virtual_spheres.emplace_back(new VirtualWrapper<Sphere>(s));
+
+    double loop = 0, batched = 0, virt = 0;
+    double sum_loop, sum_batched, sum_virtual;
+    for (int run = 0; run < runs; run++)
+    {
+        loop = std::max(loop, measure(rays, [&](const Vec3f &o, const Vec3f &d, Vec3f &hit, Vec3f &N, Material &mat) { return sphere_loop_intersect(o, d, spheres.spheres, hit, N, mat); }, sum_loop));
+        batched = std::max(batched, measure(rays, [&](const Vec3f &o, const Vec3f &d, Vec3f &hit, Vec3f &N, Material &mat) { return sceneIntersect(o, d, spheres, hit, N, mat); }, sum_batched));
+        virt = std::max(virt, measure(rays, [&](const Vec3f &o, const Vec3f &d, Vec3f &hit, Vec3f &N, Material &mat) { return virtual_intersect(o, d, virtual_spheres, hit, N, mat); }, sum_virtual));
+    }
+    out << "spheres\t" << spheres.size() << "\t" << loop << "\t" << batched << "\t" << virt << std::endl;
+    if (sum_loop != sum_batched || sum_loop != sum_virtual)
+        out << "warning: the three loops disagree on the sphere scene" << std::endl;
+
+    for (size_t n = 16; n <= 256; n *= 4)
+    {
+        Scene mixed;
+        VirtualScene virtual_mixed;
+        build_mixed_scene(n, mixed, virtual_mixed);
+        batched = virt = 0;
+        for (int run = 0; run < runs; run++)
+        {
+            batched = std::max(batched, measure(rays, [&](const Vec3f &o, const Vec3f &d, Vec3f &hit, Vec3f &N, Material &mat) { return sceneIntersect(o, d, mixed, hit, N, mat); }, sum_batched));
+            virt = std::max(virt, measure(rays, [&](const Vec3f &o, const Vec3f &d, Vec3f &hit, Vec3f &N, Material &mat) { return virtual_intersect(o, d, virtual_mixed, hit, N, mat); }, sum_virtual));
+        }
+        out << "mixed\t" << mixed.size() << "\t-\t" << batched << "\t" << virt << std::endl;
+        if (sum_batched != sum_virtual)
+            out << "warning: batched and virtual loops disagree on the mixed scene" << std::endl;
+    }
+    out.unsetf(std::ios::fixed);
+}
@@ -0,0 +1,9 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+#include <iostream>
+
+// primary rays against the sphere scene and growing mixed scenes: the old sphere-only loop,
+// the batched per-type sceneIntersect and a virtual-call hierarchy, in Mrays/s
+void bench_primitives(std::ostream &out);
+
+#endif //__BENCH_H__
@@ -0,0 +1,42 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+enum PixelFormat
+{
+    PIXEL_RGB32F,  // 12 bytes per pixel, three floats, what the renderers compute
+    PIXEL_RGBA16F, // 8 bytes per pixel, half floats (alpha = 1), keeps the HDR range for accumulation
+    PIXEL_RGB8     // 3 bytes per pixel, already quantized the way the PPM / encoder output expects it
+};
+
+bool parse_pixel_format(const std::string &name, PixelFormat &format); // "rgb32f", "rgba16f" or "rgb8"
+size_t pixel_size(PixelFormat format);                                 // bytes per pixel
+
+struct FrameBuffer
+{
+    size_t w, h;              // image dimensions
+    PixelFormat format;       // storage layout of img
+    std::vector<uint8_t> img; // storage container, w * h * pixel_size(format) bytes
+
+    FrameBuffer(const size_t w, const size_t h, const PixelFormat format);
+    uint8_t *row(const size_t j) { return img.data() + j * w * pixel_size(format); }
+    const uint8_t *row(const size_t j) const { return img.data() + j * w * pixel_size(format); }
+    void store_row(const size_t j, const Vec3f *colors); // converts one row of colors into the storage format
+    void load_row(const size_t j, Vec3f *colors) const;  // and back (lossy for the compact formats)
+    void drop_ppm_image(const std::string &filename) const;
+};
+
+// conversion kernels, n is the number of pixels; SSE / F16C when the compiler targets them, scalar otherwise
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+void convert_rgb32f_to_rgba16f(const float *src, uint16_t *dst, size_t n);
+void convert_rgba16f_to_rgb32f(const uint16_t *src, float *dst, size_t n);
+void convert_rgb32f_to_rgb8(const float *src, uint8_t *dst, size_t n);
+void convert_rgba16f_to_rgb8(const uint16_t *src, uint8_t *dst, size_t n);
+void convert_rgb8_to_rgb32f(const uint8_t *src, float *dst, size_t n);
+
+#endif //__FRAMEBUFFER_H__
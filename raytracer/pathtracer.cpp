@@ -0,0 +1,164 @@
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include "pathtracer.h"
+
+static Vec3f mul(const Vec3f &a, const Vec3f &b) // component-wise product
+{
+    return Vec3f(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+// cosine weighted direction around n, the orthonormal basis is from Duff et al. "Building an Orthonormal Basis, Revisited"
+static Vec3f cosine_sample_hemisphere(const Vec3f &n, float u1, float u2)
+{
+    float r = sqrtf(u1);
+    float phi = 2.f * M_PI * u2;
+    float x = r * cosf(phi), y = r * sinf(phi), z = sqrtf(std::max(0.f, 1.f - u1));
+
+    float sign = std::copysign(1.f, n.z);
+    float a = -1.f / (sign + n.z);
+    float b = n.x * n.y * a;
+    Vec3f t(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    Vec3f bt(b, sign + n.y * n.y * a, -n.y);
+    return t * x + bt * y + n * z;
+}
+
+Vec3f trace_path(Vec3f orig, Vec3f dir, const Scene &scene, const std::vector<Light> &lights, Pcg32 &rng, const PathTracerOptions &opt)
+{
+    const Vec3f background(0.3, 0.3, 0.3); // same environment as cast_ray
+    Vec3f radiance(0, 0, 0), throughput(1, 1, 1);
+
+    for (int bounce = 0; bounce < opt.max_bounces; bounce++)
+    {
+        Vec3f point, N;
+        Material mat;
+        if (!sceneIntersect(orig, dir, scene, point, N, mat))
+        {
+            radiance = radiance + mul(throughput, background);
+            break;
+        }
+
+        // next-event estimation: point lights can not be hit by chance, so every vertex connects to them explicitly
+        radiance = radiance + mul(throughput, direct_lighting(point, N, dir, mat, scene, lights));
+
+        // pick one of the diffuse / mirror / refraction lobes proportionally to its albedo, the estimator weight is then the albedo sum
+        float w_diffuse = mat.albedo[0], w_reflect = mat.albedo[2], w_refract = mat.albedo[3];
+        float w_sum = w_diffuse + w_reflect + w_refract;
+        if (w_sum <= 0)
+            break;
+        float u = rng.next_float() * w_sum;
+        if (u < w_diffuse)
+        {
+            Vec3f facing = N * dir < 0 ? N : -N;
+            dir = cosine_sample_hemisphere(facing, rng.next_float(), rng.next_float()).normalize();
+            throughput = mul(throughput, mat.diffuse_color * w_sum);
+        }
+        else
+        {
+            Vec3f refract_dir = refract(dir, N, mat.refractive_index);
+            bool reflected = u < w_diffuse + w_reflect || refract_dir * refract_dir == 0; // total internal reflection falls back to the mirror
+            dir = (reflected ? reflect(dir, N) : refract_dir).normalize();
+            throughput = throughput * w_sum;
+        }
+        orig = dir * N < 0 ? point - N * 1e-3 : point + N * 1e-3;
+
+        // Russian roulette: survive with a probability following the throughput and reweight the survivors, the expected path length stays O(1)
+        if (bounce + 1 >= opt.min_bounces)
+        {
+            float survive = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+            if (rng.next_float() >= survive)
+                break;
+            throughput = throughput * (1.f / survive);
+        }
+    }
+    return radiance;
+}
+
+Vec3f sample_pixel(int i, int j, int width, int height, float fov, const Scene &scene, const std::vector<Light> &lights,
+                          int first_pass, int passes, const PathTracerOptions &opt)
+{
+    Vec3f sum(0, 0, 0);
+    for (int pass = first_pass; pass < first_pass + passes; pass++)
+    {
+        // the stream only depends on the pixel and the pass, never on which thread renders it
+        Pcg32 rng(mix_seed(opt.seed ^ mix_seed(pass)), (uint64_t)(i + j * width));
+        Vec3f dir = camera_ray(i + rng.next_float(), j + rng.next_float(), width, height, fov);
+        sum = sum + trace_path(Vec3f(0, 0, 0), dir, scene, lights, rng, opt);
+    }
+    return sum;
+}
+
+void accumulate_path_traced(std::vector<Vec3f> &accum, int width, int height, float fov, const Scene &scene, const std::vector<Light> &lights,
+                            int first_pass, int passes, const PathTracerOptions &opt)
+{
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int j = 0; j < height; j++)
+    {
+        for (int i = 0; i < width; i++)
+            accum[i + j * width] = accum[i + j * width] + sample_pixel(i, j, width, height, fov, scene, lights, first_pass, passes, opt);
+    }
+}
+
+void render_path_traced(FrameBuffer &fb, float fov, const Scene &scene, const std::vector<Light> &lights, const PathTracerOptions &opt)
+{
+#pragma omp parallel
+    {
+        std::vector<Vec3f> row(fb.w); // float scratch, converted to the storage format once the row is done
+#pragma omp for schedule(dynamic, 1)
+        for (int j = 0; j < (int)fb.h; j++)
+        {
+            for (int i = 0; i < (int)fb.w; i++)
+                row[i] = sample_pixel(i, j, fb.w, fb.h, fov, scene, lights, 0, opt.spp, opt) * (1.f / opt.spp);
+            fb.store_row(j, row.data());
+        }
+    }
+}
+
+float rmse(const std::vector<Vec3f> &image, const std::vector<Vec3f> &reference)
+{
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        for (size_t c = 0; c < 3; c++)
+        {
+            double d = std::max(0.f, std::min(1.f, image[i][c])) - std::max(0.f, std::min(1.f, reference[i][c]));
+            sum += d * d;
+        }
+    }
+    return std::sqrt(sum / (image.size() * 3));
+}
+
+void report_convergence(FrameBuffer &fb, float fov, const Scene &scene, const std::vector<Light> &lights, const PathTracerOptions &opt,
+                        int reference_spp, std::ostream &out)
+{
+    typedef std::chrono::steady_clock clock;
+    const int width = fb.w, height = fb.h;
+
+    PathTracerOptions ref_opt = opt; // independent samples, otherwise the estimate converges toward its own noise
+    ref_opt.seed = mix_seed(opt.seed + 1);
+    std::vector<Vec3f> reference(width * height, Vec3f(0, 0, 0));
+    clock::time_point start = clock::now();
+    accumulate_path_traced(reference, width, height, fov, scene, lights, 0, reference_spp, ref_opt);
+    for (Vec3f &c : reference)
+        c = c * (1.f / reference_spp);
+    out << "reference: " << reference_spp << " spp in " << std::chrono::duration<double>(clock::now() - start).count() << " s" << std::endl;
+
+    std::vector<Vec3f> accum(width * height, Vec3f(0, 0, 0)), estimate(width * height);
+    double seconds = 0; // render time only, the error evaluation is not counted
+    out << "spp\tseconds\trmse" << std::endl;
+    for (int done = 0, next = 1; done < opt.spp; next = std::min(next * 2, opt.spp))
+    {
+        start = clock::now();
+        accumulate_path_traced(accum, width, height, fov, scene, lights, done, next - done, opt);
+        seconds += std::chrono::duration<double>(clock::now() - start).count();
+        done = next;
+
+        for (size_t i = 0; i < accum.size(); i++)
+            estimate[i] = accum[i] * (1.f / done);
+        out << done << "\t" << std::fixed << std::setprecision(3) << seconds << "\t" << std::setprecision(5) << rmse(estimate, reference) << std::endl;
+        out.unsetf(std::ios::fixed);
+    }
+    for (int j = 0; j < height; j++)
+        fb.store_row(j, &estimate[j * width]);
+}
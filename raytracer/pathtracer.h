@@ -0,0 +1,41 @@
+#ifndef __PATHTRACER_H__
+#define __PATHTRACER_H__
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "geometry.h"
+#include "scene.h"
+#include "framebuffer.h"
+#include "rng.h"
+
+struct PathTracerOptions
+{
+    int spp = 64;          // samples per pixel
+    int min_bounces = 3;   // bounces taken unconditionally before Russian roulette starts
+    int max_bounces = 256; // safety net only, Russian roulette ends paths long before that
+    uint64_t seed = 0;     // base seed, each (pixel, pass) gets its own stream derived from it
+};
+
+// Monte Carlo estimate of the radiance arriving at orig from direction dir (one path, next-event estimation toward the point lights)
+Vec3f trace_path(Vec3f orig, Vec3f dir, const Scene &scene, const std::vector<Light> &lights, Pcg32 &rng, const PathTracerOptions &opt);
+
+// sum of the samples of passes [first_pass, first_pass + passes) for pixel (i, j)
+Vec3f sample_pixel(int i, int j, int width, int height, float fov, const Scene &scene, const std::vector<Light> &lights,
+                   int first_pass, int passes, const PathTracerOptions &opt);
+
+// adds one sample per pixel for every pass in [first_pass, first_pass + passes) to the running sum stored in accum
+void accumulate_path_traced(std::vector<Vec3f> &accum, int width, int height, float fov, const Scene &scene, const std::vector<Light> &lights,
+                            int first_pass, int passes, const PathTracerOptions &opt);
+
+// opt.spp samples per pixel, averaged and stored row by row in the framebuffer's pixel format
+void render_path_traced(FrameBuffer &fb, float fov, const Scene &scene, const std::vector<Light> &lights, const PathTracerOptions &opt);
+
+// root mean square error between two images, on display values clamped to [0, 1]
+float rmse(const std::vector<Vec3f> &image, const std::vector<Vec3f> &reference);
+
+// renders a reference with reference_spp samples, then prints "spp seconds rmse" while doubling the sample count up to opt.spp;
+// the final estimate is stored in fb
+void report_convergence(FrameBuffer &fb, float fov, const Scene &scene, const std::vector<Light> &lights, const PathTracerOptions &opt,
+                        int reference_spp, std::ostream &out);
+
+#endif //__PATHTRACER_H__
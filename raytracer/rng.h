@@ -0,0 +1,43 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+#include <cstdint>
+
+// PCG32 (http://www.pcg-random.org): 64 bit LCG state with a permuted 32 bit output.
+// Every generator lives on the stack of the code that uses it, so there is no shared state between threads.
+struct Pcg32
+{
+    Pcg32(uint64_t seed, uint64_t stream) : state(0), inc((stream << 1u) | 1u)
+    {
+        next_u32();
+        state += seed;
+        next_u32();
+    }
+
+    uint32_t next_u32()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    float next_float() // uniform in [0, 1)
+    {
+        return (next_u32() >> 8) * (1.f / 16777216.f);
+    }
+
+    uint64_t state;
+    uint64_t inc;
+};
+
+// SplitMix64 finalizer, turns (pixel, pass) indices into well spread seeds
+inline uint64_t mix_seed(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+#endif //__RNG_H__
@@ -0,0 +1,131 @@
+#include <limits>
+#include <cmath>
+#include <vector>
+#include "scene.h"
+
+Vec3f reflect(const Vec3f &light, const Vec3f &normal)
+{
+    return light - normal * 2.f * (light * normal);
+}
+
+Vec3f refract(const Vec3f &I, const Vec3f &N, const float &refractive_index)
+{
+    float cosi = -std::max(-1.f, std::min(1.f, I * N));
+    float etai = 1, etat = refractive_index;
+    Vec3f n = N;
+    if (cosi < 0)
+    {
+        cosi = -cosi;
+        std::swap(etai, etat);
+        n = -N;
+    }
+    float eta = etai / etat;
+    float k = 1 - eta * eta * (1 - cosi * cosi);
+    return k < 0 ? Vec3f(0, 0, 0) : I * eta + n * (eta * cosi - sqrtf(k));
+}
+
+enum PrimitiveKind
+{
+    NONE,
+    SPHERE,
+    PLANE,
+    BOX,
+    TRIANGLE
+};
+
+// closest hit within one homogeneous batch; the primitive type is known at compile time so ray_intersect inlines
+template <typename T>
+static inline void closest_in(const std::vector<T> &batch, PrimitiveKind kind, const Vec3f &orig, const Vec3f &dir, float &dist, PrimitiveKind &hit_kind, size_t &hit_index)
+{
+    const T *closest = nullptr;
+    for (const T &prim : batch)
+    {
+        if (prim.ray_intersect(orig, dir, dist))
+            closest = &prim;
+    }
+    if (closest)
+    {
+        hit_kind = kind;
+        hit_index = closest - batch.data();
+    }
+}
+
+template <typename T>
+static inline void surface(const std::vector<T> &batch, size_t i, const Vec3f &hit, Vec3f &N, Material &mat)
+{
+    N = batch[i].normal(hit);
+    mat = batch[i].material;
+}
+
+bool sceneIntersect(const Vec3f &orig, const Vec3f &dir, const Scene &scene, Vec3f &hit, Vec3f &N, Material &mat)
+{
+    float dist = std::numeric_limits<float>::max();
+    PrimitiveKind kind = NONE;
+    size_t index = 0;
+    closest_in(scene.spheres, SPHERE, orig, dir, dist, kind, index);
+    closest_in(scene.planes, PLANE, orig, dir, dist, kind, index);
+    closest_in(scene.boxes, BOX, orig, dir, dist, kind, index);
+    closest_in(scene.triangles, TRIANGLE, orig, dir, dist, kind, index);
+
+    if (kind == NONE)
+        return false;
+    hit = orig + dir * dist; // the normal and material are only fetched for the closest primitive
+    switch (kind)
+    {
+    case SPHERE:
+        surface(scene.spheres, index, hit, N, mat);
+        break;
+    case PLANE:
+        surface(scene.planes, index, hit, N, mat);
+        break;
+    case BOX:
+        surface(scene.boxes, index, hit, N, mat);
+        break;
+    default:
+        surface(scene.triangles, index, hit, N, mat);
+    }
+    return dist < 1000; // Ray is not infinite we set a limit to 1000 (== far plane is 1000)
+}
+
+Vec3f direct_lighting(const Vec3f &point, const Vec3f &N, const Vec3f &dir, const Material &mat, const Scene &scene, const std::vector<Light> &lights)
+{
+    float diffuseIntensity = 0, specular_light_intensity = 0;
+    for (const Light &l : lights)
+    {
+        Vec3f lightDir = (l.position - point).normalize(); // Vector from light source to point
+        float listDist = (l.position - point).norm();      // Distance from light source to point
+
+        Vec3f shadow_orig = lightDir * N < 0 ? point - N * 1e-3 : point + N * 1e-3; // Point + N * 1e-3 is to avoid shadow acne
+        Vec3f shadow_pt, shadow_N;
+
+        Material tmpmaterial;
+        if (sceneIntersect(shadow_orig, lightDir, scene, shadow_pt, shadow_N, tmpmaterial) && (shadow_pt - shadow_orig).norm() < listDist)
+            continue; // do not get diffuse or specular intensity
+
+        diffuseIntensity += l.intensity * std::max(0.f, lightDir * N); // Diffuse intensity is the dot product of the light direction and the normal
+        specular_light_intensity += powf(std::max(0.f, reflect(lightDir, N) * dir), mat.specular_exponent) * l.intensity;
+    }
+    return mat.diffuse_color * diffuseIntensity * mat.albedo[0] + Vec3f(1., 1., 1.) * specular_light_intensity * mat.albedo[1];
+}
+
+void build_scene(Scene &scene, std::vector<Light> &lights)
+{
+    Material babyBlue = {1.0, Vec4f(0.6, 0.3, 0.1, 0.0), Vec3f(0.537, 0.812, 0.941), 50};
+    Material babyPink = {1.0, Vec4f(0.6, 0.3, 0.0, 0.0), Vec3f(0.941, 0.537, 0.812), 5};
+    Material mirror = {1.0, Vec4f(0.0, 10.0, 0.8, 0.0), Vec3f(1.0, 1.0, 1.0), 1425.};
+    Material glass = {1.5, Vec4f(0.0, 0.5, 0.1, 0.8), Vec3f(0.6, 0.7, 0.8), 125.};
+
+    scene.spheres.push_back(Sphere(Vec3f(-3, 0, -16), 2, babyPink));
+    scene.spheres.push_back(Sphere(Vec3f(-1.0, -1.5, -12), 2, glass));
+    scene.spheres.push_back(Sphere(Vec3f(1.5, -0.5, -18), 3, babyBlue));
+    scene.spheres.push_back(Sphere(Vec3f(7, 5, -18), 4, mirror));
+
+    lights.emplace_back(Vec3f(-20, 20, 20), 1.5f);
+}
+
+Vec3f camera_ray(double x, double y, int width, int height, float fov)
+{
+    float dir_x = (2 * x / (float)width - 1) * tan(fov / 2.) * width / (float)height;
+    float dir_y = -(2 * y / (float)height - 1) * tan(fov / 2.);
+    return Vec3f(dir_x, dir_y, -1).normalize();
+}
@@ -0,0 +1,194 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "geometry.h"
+
+struct Material
+{
+    Material(const float &r, const Vec4f &a, const Vec3f &color, const float &spec)
+        : refractive_index{r}, albedo(a), diffuse_color(color), specular_exponent(spec) {}
+    Material() : refractive_index{1}, albedo(1, 0, 0, 0), diffuse_color(), specular_exponent() {}
+
+    float refractive_index; // index of refraction
+    Vec4f albedo;           // fraction of light that is diffusely reflected by a body
+    Vec3f diffuse_color;
+    float specular_exponent;
+};
+
+struct Sphere
+{
+    // Define the center and radius of the sphere
+    Vec3f center;
+    float radius;
+    Material material;
+
+    Sphere(const Vec3f &c, const float &r, const Material &mat) : center{c}, radius{r}, material{mat} {}
+
+    // intersecting algorithm: http://www.lighthouse3d.com/tutorials/maths/ray-sphere-intersection/
+    bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const
+    {
+        Vec3f vpc = center - p;
+        float projection = vpc * dir;
+        float disToRay = vpc * vpc - projection * projection;
+
+        // if (|vpc| > r) there is no intersection
+        if (disToRay > radius * radius)
+            return false;
+        float t0todisToRay = sqrtf((radius * radius) - disToRay);
+        float t0 = projection - t0todisToRay;
+        float t1 = projection + t0todisToRay;
+        if (t0 < 0)
+            t0 = t1;
+        if (t0 < 0)
+            return false;
+
+        if (t0 < closestDist)
+        {
+            closestDist = t0;
+            return true;
+        }
+        return false;
+    }
+
+    Vec3f normal(const Vec3f &hit) const { return (hit - center).normalize(); }
+};
+
+struct Plane
+{
+    // all points p with N * p == offset
+    Vec3f N;
+    float offset;
+    Material material;
+
+    Plane(const Vec3f &n, const float &d, const Material &mat) : N{n}, offset{d}, material{mat} { N.normalize(); }
+
+    bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const
+    {
+        float denom = N * dir;
+        if (std::abs(denom) < 1e-6f) // parallel to the plane
+            return false;
+        float t = (offset - N * p) / denom;
+        if (t < 0 || t >= closestDist)
+            return false;
+        closestDist = t;
+        return true;
+    }
+
+    Vec3f normal(const Vec3f &) const { return N; }
+};
+
+struct Box
+{
+    // axis aligned, given by its two opposite corners
+    Vec3f lo, hi;
+    Material material;
+
+    Box(const Vec3f &a, const Vec3f &b, const Material &mat)
+        : lo{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)}, hi{std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}, material{mat} {}
+
+    // slab test: intersect the three pairs of parallel planes and keep the overlap of the parameter ranges
+    bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const
+    {
+        float t_near = -std::numeric_limits<float>::max(), t_far = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < 3; i++)
+        {
+            float inv = 1.f / dir[i];
+            float t0 = (lo[i] - p[i]) * inv, t1 = (hi[i] - p[i]) * inv;
+            t_near = std::max(t_near, std::min(t0, t1));
+            t_far = std::min(t_far, std::max(t0, t1));
+        }
+        if (t_near > t_far || t_far < 0)
+            return false;
+        float t = t_near < 0 ? t_far : t_near; // the ray starts inside the box
+        if (t >= closestDist)
+            return false;
+        closestDist = t;
+        return true;
+    }
+
+    Vec3f normal(const Vec3f &hit) const // the face whose plane is closest to the hit point
+    {
+        size_t axis = 0;
+        float best = std::numeric_limits<float>::max(), sign = 1;
+        for (size_t i = 0; i < 3; i++)
+        {
+            float dlo = std::abs(hit[i] - lo[i]), dhi = std::abs(hit[i] - hi[i]);
+            if (dlo < best)
+                best = dlo, axis = i, sign = -1;
+            if (dhi < best)
+                best = dhi, axis = i, sign = 1;
+        }
+        Vec3f n(0, 0, 0);
+        n[axis] = sign;
+        return n;
+    }
+};
+
+struct Triangle
+{
+    Vec3f v0, e1, e2, N; // first vertex, the two edges leaving it and the unit normal
+    Material material;
+
+    Triangle(const Vec3f &a, const Vec3f &b, const Vec3f &c, const Material &mat) : v0{a}, e1{b - a}, e2{c - a}, N{cross(b - a, c - a).normalize()}, material{mat} {}
+
+    // Moller-Trumbore: https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
+    bool ray_intersect(const Vec3f &p, const Vec3f &dir, float &closestDist) const
+    {
+        Vec3f pvec = cross(dir, e2);
+        float det = e1 * pvec;
+        if (std::abs(det) < 1e-8f)
+            return false;
+        float inv_det = 1.f / det;
+        Vec3f tvec = p - v0;
+        float u = (tvec * pvec) * inv_det;
+        if (u < 0 || u > 1)
+            return false;
+        Vec3f qvec = cross(tvec, e1);
+        float v = (dir * qvec) * inv_det;
+        if (v < 0 || u + v > 1)
+            return false;
+        float t = (e2 * qvec) * inv_det;
+        if (t < 0 || t >= closestDist)
+            return false;
+        closestDist = t;
+        return true;
+    }
+
+    Vec3f normal(const Vec3f &) const { return N; }
+};
+
+// Primitives are kept in one homogeneous array per type and intersected batch after batch, so every inner loop
+// is a direct (inlinable) call on a single type; adding a primitive type means adding its array here and one
+// line to sceneIntersect, there is no virtual dispatch on the hot path. It is not free on a spheres-only scene: the
+// other batches in the same function cost about 11% against the old sphere loop (--bench-primitives, 70 vs 79
+// Mrays/s on the 4 spheres), the same with empty batches skipped or called out of line.
+struct Scene
+{
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    std::vector<Box> boxes;
+    std::vector<Triangle> triangles;
+
+    size_t size() const { return spheres.size() + planes.size() + boxes.size() + triangles.size(); }
+};
+
+struct Light
+{
+    // Point Light Source
+    Light(const Vec3f &p, const float &i) : position(p), intensity(i) {}
+    Vec3f position;
+    float intensity;
+};
+
+Vec3f reflect(const Vec3f &light, const Vec3f &normal);
+Vec3f refract(const Vec3f &I, const Vec3f &N, const float &refractive_index);
+bool sceneIntersect(const Vec3f &orig, const Vec3f &dir, const Scene &scene, Vec3f &hit, Vec3f &N, Material &mat);
+// diffuse + specular light arriving at point straight from the light sources (shadow rays included)
+Vec3f direct_lighting(const Vec3f &point, const Vec3f &N, const Vec3f &dir, const Material &mat, const Scene &scene, const std::vector<Light> &lights);
+
+void build_scene(Scene &scene, std::vector<Light> &lights);             // the four balls and the key light
+Vec3f camera_ray(double x, double y, int width, int height, float fov); // direction through the image point (x, y), in pixels
+
+#endif //__SCENE_H__
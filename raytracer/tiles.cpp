@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "tiles.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static bool write_all(int fd, const void *data, size_t n)
+{
+    const char *p = static_cast<const char *>(data);
+    while (n > 0)
+    {
+        ssize_t k = write(fd, p, n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *data, size_t n)
+{
+    char *p = static_cast<char *>(data);
+    while (n > 0)
+    {
+        ssize_t k = read(fd, p, n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+// renders the tile and converts it to the job's pixel format, rows top to bottom
+static void render_tile_pixels(const TileRenderer &render_tile, const TileRequest &req, PixelFormat format, FrameBuffer &tile, std::vector<Vec3f> &colors)
+{
+    colors.resize(req.w * req.h);
+    render_tile(req.x0, req.y0, req.w, req.h, colors.data());
+    tile = FrameBuffer(req.w, req.h, format);
+    for (size_t j = 0; j < req.h; j++)
+        tile.store_row(j, &colors[j * req.w]);
+}
+
+void serve_tiles(int fd, const TileRenderer &render_tile)
+{
+    TileJob job;
+    if (!read_all(fd, &job, sizeof(job)) || job.magic != TILE_JOB_MAGIC)
+        return;
+    FrameBuffer tile(0, 0, (PixelFormat)job.format);
+    std::vector<Vec3f> colors;
+    TileRequest req;
+    while (read_all(fd, &req, sizeof(req)) && req.magic == TILE_REQUEST_MAGIC)
+    {
+        render_tile_pixels(render_tile, req, (PixelFormat)job.format, tile, colors);
+        TileResult res = {TILE_RESULT_MAGIC, req.tile, req.w, req.h};
+        if (!write_all(fd, &res, sizeof(res)) || !write_all(fd, tile.img.data(), tile.img.size()))
+            return;
+    }
+}
+
+struct Worker
+{
+    pid_t pid;
+    int fd;                     // coordinator end of the socket pair, -1 once the worker is gone
+    int tile;                   // tile in flight, -1 when idle
+    Clock::time_point started;  // when the tile in flight was sent
+    std::vector<uint8_t> inbox; // bytes of the result being received
+    int tiles_done;
+};
+
+static void copy_tile(FrameBuffer &fb, const TileRequest &t, const uint8_t *pixels)
+{
+    const size_t row_bytes = t.w * pixel_size(fb.format);
+    for (size_t j = 0; j < t.h; j++)
+        memcpy(fb.row(t.y0 + j) + t.x0 * pixel_size(fb.format), pixels + j * row_bytes, row_bytes);
+}
+
+bool render_tiles_multiprocess(FrameBuffer &fb, const TileRenderer &render_tile, const TileOptions &opt, std::ostream &log)
+{
+    std::vector<TileRequest> tiles;
+    for (size_t y = 0; y < fb.h; y += opt.tile_size)
+    {
+        for (size_t x = 0; x < fb.w; x += opt.tile_size)
+        {
+            TileRequest t = {TILE_REQUEST_MAGIC, (uint32_t)tiles.size(), (uint32_t)x, (uint32_t)y,
+                             (uint32_t)std::min<size_t>(opt.tile_size, fb.w - x), (uint32_t)std::min<size_t>(opt.tile_size, fb.h - y)};
+            tiles.push_back(t);
+        }
+    }
+
+    // a dead worker must show up as a failed write, not kill the coordinator
+    void (*old_sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    log.flush(); // the children inherit the stream buffers
+
+    const TileJob job = {TILE_JOB_MAGIC, (uint32_t)fb.w, (uint32_t)fb.h, (uint32_t)fb.format};
+    std::vector<Worker> workers;
+    for (int k = 0; k < opt.workers; k++)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+            break;
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(sv[0]);
+            close(sv[1]);
+            break;
+        }
+        if (pid == 0)
+        {
+            for (const Worker &w : workers) // only our own end of our own pair stays open, so EOF reaches everybody
+                close(w.fd);
+            close(sv[0]);
+            serve_tiles(sv[1], render_tile);
+            _exit(0);
+        }
+        close(sv[1]);
+        Worker w = {pid, sv[0], -1, Clock::now(), std::vector<uint8_t>(), 0};
+        if (!write_all(w.fd, &job, sizeof(job)))
+        {
+            close(w.fd);
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            continue;
+        }
+        workers.push_back(w);
+    }
+    if (workers.empty())
+    {
+        signal(SIGPIPE, old_sigpipe);
+        return false;
+    }
+
+    std::deque<int> pending;
+    for (size_t i = 0; i < tiles.size(); i++)
+        pending.push_back(i);
+    std::vector<bool> done(tiles.size(), false);
+    size_t done_count = 0;
+    double busy_seconds = 0; // sum of the accepted tile times, for the automatic timeout
+    int reissued = 0, crashed = 0;
+    Clock::time_point start = Clock::now();
+
+    auto holders = [&](int tile) {
+        int n = 0;
+        for (const Worker &w : workers)
+            n += w.fd >= 0 && w.tile == tile;
+        return n;
+    };
+    auto retire = [&](Worker &w) { // the worker crashed or hung up: drop it and put its tile back in line
+        close(w.fd);
+        w.fd = -1;
+        kill(w.pid, SIGKILL);
+        waitpid(w.pid, nullptr, 0);
+        crashed++;
+        if (w.tile >= 0 && !done[w.tile] && !holders(w.tile))
+            pending.push_front(w.tile);
+        w.tile = -1;
+    };
+
+    while (done_count < tiles.size())
+    {
+        double timeout = opt.tile_timeout > 0 ? opt.tile_timeout : (done_count ? 4 * busy_seconds / done_count : 1e30);
+        for (Worker &w : workers)
+        {
+            if (w.fd < 0 || w.tile >= 0)
+                continue;
+            int next = -1;
+            while (!pending.empty() && next < 0) // tiles may have been finished by a duplicate meanwhile
+            {
+                next = pending.front();
+                pending.pop_front();
+                if (done[next])
+                    next = -1;
+            }
+            if (next < 0) // nothing queued: back up the oldest straggler that is running alone
+            {
+                double oldest = timeout;
+                for (const Worker &o : workers)
+                {
+                    double age = std::chrono::duration<double>(Clock::now() - o.started).count();
+                    if (o.fd >= 0 && o.tile >= 0 && !done[o.tile] && age > oldest && holders(o.tile) == 1)
+                    {
+                        oldest = age;
+                        next = o.tile;
+                    }
+                }
+                if (next < 0)
+                    continue;
+                reissued++;
+            }
+            w.tile = next;
+            w.started = Clock::now();
+            if (!write_all(w.fd, &tiles[next], sizeof(TileRequest)))
+                retire(w);
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<Worker *> polled;
+        for (Worker &w : workers)
+        {
+            if (w.fd < 0)
+                continue;
+            pollfd p = {w.fd, POLLIN, 0};
+            fds.push_back(p);
+            polled.push_back(&w);
+        }
+        if (fds.empty()) // every worker is gone, finish in-process
+        {
+            log << "tiles: all workers lost, rendering " << tiles.size() - done_count << " tiles locally" << std::endl;
+            FrameBuffer tile(0, 0, fb.format);
+            std::vector<Vec3f> colors;
+            for (size_t i = 0; i < tiles.size(); i++)
+            {
+                if (done[i])
+                    continue;
+                render_tile_pixels(render_tile, tiles[i], fb.format, tile, colors);
+                copy_tile(fb, tiles[i], tile.img.data());
+                done[i] = true;
+                done_count++;
+            }
+            break;
+        }
+        if (poll(fds.data(), fds.size(), 100) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // the workers cannot be heard any more: drop them all, the next round renders the outstanding tiles here
+            log << "tiles: poll failed (" << strerror(errno) << "), dropping the workers" << std::endl;
+            for (Worker &w : workers)
+                if (w.fd >= 0)
+                    retire(w);
+            continue;
+        }
+
+        for (size_t k = 0; k < fds.size(); k++)
+        {
+            if (!fds[k].revents)
+                continue;
+            Worker &w = *polled[k];
+            uint8_t buf[1 << 16];
+            ssize_t n = read(w.fd, buf, sizeof(buf)); // poll said readable, so this does not block
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                log << "tiles: worker " << w.pid << " died" << (w.tile >= 0 ? ", requeueing its tile" : "") << std::endl;
+                retire(w);
+                continue;
+            }
+            w.inbox.insert(w.inbox.end(), buf, buf + n);
+
+            TileResult res;
+            if (w.inbox.size() < sizeof(res))
+                continue;
+            memcpy(&res, w.inbox.data(), sizeof(res));
+            if (res.magic != TILE_RESULT_MAGIC || (int)res.tile != w.tile || res.w != tiles[w.tile].w || res.h != tiles[w.tile].h)
+            {
+                log << "tiles: worker " << w.pid << " sent garbage" << std::endl;
+                retire(w);
+                continue;
+            }
+            size_t size = sizeof(res) + res.w * res.h * pixel_size(fb.format);
+            if (w.inbox.size() < size)
+                continue;
+            if (!done[w.tile]) // a slower duplicate of an accepted tile is dropped
+            {
+                copy_tile(fb, tiles[w.tile], w.inbox.data() + sizeof(res));
+                done[w.tile] = true;
+                done_count++;
+                busy_seconds += std::chrono::duration<double>(Clock::now() - w.started).count();
+                w.tiles_done++;
+            }
+            w.inbox.clear();
+            w.tile = -1;
+        }
+    }
+
+    for (Worker &w : workers)
+    {
+        if (w.fd < 0)
+            continue;
+        close(w.fd); // EOF ends idle workers, a worker still busy on a dropped duplicate is not worth waiting for
+        if (w.tile >= 0)
+            kill(w.pid, SIGKILL);
+        waitpid(w.pid, nullptr, 0);
+    }
+    signal(SIGPIPE, old_sigpipe);
+
+    log << "tiles: " << tiles.size() << " tiles of " << opt.tile_size << "px on " << workers.size() << " workers in "
+        << std::chrono::duration<double>(Clock::now() - start).count() << " s, " << reissued << " reissued, " << crashed << " lost" << std::endl;
+    for (const Worker &w : workers)
+        log << "  worker " << w.pid << ": " << w.tiles_done << " tiles" << std::endl;
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef __TILES_H__
+#define __TILES_H__
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include "geometry.h"
+#include "framebuffer.h"
+
+// Wire protocol between the coordinator and its workers. Every message is a fixed-size header in host byte order,
+// so it runs over any stream socket: the socket pairs used for local workers today, TCP to other hosts later.
+//   coordinator -> worker : TileJob once, then any number of TileRequest; closing the stream ends the worker
+//   worker -> coordinator : one TileResult per request, followed by w * h * pixel_size(format) bytes, rows top to bottom
+const uint32_t TILE_JOB_MAGIC = 0x424f4a54;     // "TJOB" in memory on little endian hosts
+const uint32_t TILE_REQUEST_MAGIC = 0x51455254; // "TREQ"
+const uint32_t TILE_RESULT_MAGIC = 0x53455254;  // "TRES"
+
+struct TileJob
+{
+    uint32_t magic, width, height, format; // format is a PixelFormat
+};
+
+struct TileRequest
+{
+    uint32_t magic, tile, x0, y0, w, h;
+};
+
+struct TileResult
+{
+    uint32_t magic, tile, w, h;
+};
+
+struct TileOptions
+{
+    int workers = 4;         // worker processes
+    int tile_size = 64;      // tile edge in pixels
+    double tile_timeout = 0; // seconds before an unfinished tile is also handed to an idle worker, 0 = four times the mean tile time
+};
+
+// fills colors (w * h, row-major) for the pixels [x0, x0 + w) x [y0, y0 + h)
+typedef std::function<void(int x0, int y0, int w, int h, Vec3f *colors)> TileRenderer;
+
+// Splits fb into tiles and hands them to opt.workers forked processes. Tiles of crashed workers are requeued, tiles
+// running past the timeout are duplicated on an idle worker (first result wins); if every worker is gone the rest is
+// rendered in-process. Returns false only if the workers could not be started at all.
+bool render_tiles_multiprocess(FrameBuffer &fb, const TileRenderer &render_tile, const TileOptions &opt, std::ostream &log);
+
+// worker side: serves tile requests read from fd until the coordinator closes it
+void serve_tiles(int fd, const TileRenderer &render_tile);
+
+#endif //__TILES_H__